@@ -12,6 +12,7 @@
 #include "abstract_fs.h"
 
 #include <algorithm>
+#include <new>
 
 #include <dirent.h>
 #include <errno.h>
@@ -23,12 +24,14 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <ftw.h>
+#include <sys/xattr.h>
 
 #include <gperftools/profiler.h>
+#include "arena.h"
 #include "errnoname.h"
 #include "path_utils.h"
 
-#include <unordered_set>
+#include <string>
 
 #define DIR_DEPTH_CHECK
 
@@ -50,16 +53,24 @@ const char *nlink_fs[] = {"ext4", "ext2", "jffs2"};
 const char *root_dir = "/";
 char target[PATH_MAX];
 
-std::unordered_set<std::string> exclusion_list = {
-        {"/lost+found"},
-        {"/.nilfs"},
-        {"/.mcfs_dummy"},
-        {"/build"}
+const char *exclusion_list[] = {
+        "/lost+found",
+        "/.nilfs",
+        "/.mcfs_dummy",
+        "/build"
 };
 
 /* Also ignore NFS temp files "/.nfsXXXX" */
-static inline bool is_excluded(const std::string &path) {
-    return (exclusion_list.find(path) != exclusion_list.end() || path.rfind("./nfs", 0) == 0);
+static inline bool is_excluded(const char *path) {
+    for (const char *excluded : exclusion_list) {
+        if (strcmp(path, excluded) == 0)
+            return true;
+    }
+    return strncmp(path, "./nfs", 5) == 0;
+}
+
+bool absfs_is_excluded(const char *abspath) {
+    return is_excluded(abspath);
 }
 
 static inline bool is_this_or_parent(const char *name) {
@@ -78,7 +89,7 @@ static inline bool is_this_or_parent(const char *name) {
  *          negative number for error status of open() or read()
  */
 static int hash_file_content(AbstractFile *file, absfs_t *absfs) {
-    const char *fullpath = file->fullpath.c_str();
+    const char *fullpath = file->fullpath;
     int fd = file->Open(O_RDONLY);
     char buffer[4096] = {0};
     ssize_t readsize;
@@ -90,49 +101,11 @@ static int hash_file_content(AbstractFile *file, absfs_t *absfs) {
     }
 
     while ((readsize = file->Read(fd, buffer, 4096)) > 0) {
-        switch (absfs->hash_option) {
-            case xxh128_t: {
-                ret = (XXH3_128bits_update(absfs->xxh_state, buffer, readsize) != XXH_ERROR);
-                break;
-            }
-            case xxh3_t: {
-                ret = (XXH3_64bits_update(absfs->xxh_state, buffer, readsize) != XXH_ERROR);
-                break;
-            }
-            case md5_t: {
-#if OPENSSL_VERSION_NUMBER >= 0x30000000L
-                ret = EVP_DigestUpdate(absfs->md5_state, buffer, readsize);
-#else
-                ret = MD5_Update(&absfs->md5_state, buffer, readsize);
-#endif
-                break;
-            }
-            case crc32_t: {
-                ret = (int)
-                        (absfs->crc32_state = crc32((uLong) absfs->crc32_state, (const Bytef *) buffer,
-                                                    (uInt) readsize));
-                break;
-            }
-            default: {
-                file->printer("Hash option not supported\n");
-                exit(1);
-                break;
-            }
-        }
-
-
+        ret = absfs_feed_content(absfs, buffer, readsize);
         memset(buffer, 0, sizeof(buffer));
-        /* MD5_Update returns 0 for failure and 1 for success.
-         * However, we want 0 for success and other values for error.
-         */
-        if (ret == 0) {
-            /* This is special: If returned value is +1, then it indicates
-             * MD5_Update error. Minus number for error in open() and read() */
-            ret = 1;
+        if (ret != 0) {
             file->printer("hash state pdate failed on file '%s'\n", fullpath);
             goto end;
-        } else {
-            ret = 0;
         }
     }
     if (readsize < 0) {
@@ -145,9 +118,90 @@ static int hash_file_content(AbstractFile *file, absfs_t *absfs) {
     return ret;
 }
 
+static bool hash_xattrs = false;
+/* Only this namespace is hashed: the others (e.g., security.selinux or
+ * system.posix_acl_*) legitimately differ between file systems */
+static const char xattr_prefix[] = "user.";
+
+void absfs_set_xattr_mode(bool on) {
+    hash_xattrs = on;
+}
+
+bool absfs_xattr_mode(void) {
+    return hash_xattrs;
+}
+
+/**
+ * hash_file_xattrs: Feed the extended attributes of a file into the hash
+ *   calculator, in the canonical order of their names.  The names come
+ *   from one llistxattr() and each value from one lgetxattr() into a
+ *   buffer of the right size (both are retried if the list or a value
+ *   grows in between).
+ *
+ * @return: 0 for success, negative errno on error
+ */
+static int hash_file_xattrs(AbstractFile *file, absfs_t *absfs,
+                            struct arena *scratch) {
+    const char *fullpath = file->fullpath;
+    char *names = NULL;
+    ssize_t len;
+    do {
+        len = llistxattr(fullpath, NULL, 0);
+        if (len <= 0)
+            break;
+        names = (char *)arena_alloc(scratch, len);
+        len = llistxattr(fullpath, names, len);
+    } while (len < 0 && errno == ERANGE);
+    if (len < 0) {
+        if (errno == ENOTSUP)
+            return 0;
+        file->printer("hash error: llistxattr '%s' (%s)\n", fullpath,
+                      errnoname(errno));
+        return -errno;
+    }
+
+    /* At most len / 2 names: each has one character and a NUL at least */
+    const char **sorted = (const char **)arena_alloc(
+        scratch, (len / 2 + 1) * sizeof(char *));
+    size_t nsorted = 0;
+    for (ssize_t off = 0; off < len; off += strlen(&names[off]) + 1) {
+        if (strncmp(&names[off], xattr_prefix, sizeof(xattr_prefix) - 1) == 0)
+            sorted[nsorted++] = &names[off];
+    }
+    std::sort(sorted, sorted + nsorted,
+              [](const char *a, const char *b) { return strcmp(a, b) < 0; });
+
+    for (size_t i = 0; i < nsorted; ++i) {
+        const char *name = sorted[i];
+        char *value = NULL;
+        ssize_t vlen;
+        do {
+            vlen = lgetxattr(fullpath, name, NULL, 0);
+            if (vlen <= 0)
+                break;
+            value = (char *)arena_alloc(scratch, vlen);
+            vlen = lgetxattr(fullpath, name, value, vlen);
+        } while (vlen < 0 && errno == ERANGE);
+        if (vlen < 0) {
+            /* Removed after it was listed */
+            if (errno == ENODATA)
+                continue;
+            file->printer("hash error: lgetxattr '%s' '%s' (%s)\n", fullpath,
+                          name, errnoname(errno));
+            return -errno;
+        }
+        absfs_feed_xattr(absfs, name, value, vlen);
+    }
+    return 0;
+}
+
 static const char *walker_basepath;
 static size_t basepath_len;
-static std::vector<AbstractFile> walker_files;
+static std::vector<AbstractFile *> walker_files;
+/* Records of walker_files, recycled by the next scan */
+static struct pool file_pool;
+/* Paths of walker_files and scratch buffers of the current scan */
+static struct arena scan_arena;
 static printer_t walker_printer;
 
 static const char *get_abstract_path(const char *fullpath) {
@@ -179,10 +233,16 @@ static int nftw_handler(const char *fpath, const struct stat *finfo,
     const char *abspath = get_abstract_path(fpath);
     if (is_excluded(abspath)) return FTW_SKIP_SUBTREE;
 
-    AbstractFile file;
+    void *obj = pool_get(&file_pool);
+    if (!obj) {
+        walker_printer("cannot allocate the record of %s\n", fpath);
+        return FTW_STOP;
+    }
+    AbstractFile &file = *new (obj) AbstractFile();
     file.printer = walker_printer;
-    file.fullpath = fpath;
-    file.abstract_path = abspath;
+    file.fullpath = arena_strdup(&scan_arena, fpath);
+    file.abstract_path = get_abstract_path(file.fullpath);
+    file.target_relpath = "";
     // Get the relative path of symlink target
     if (typeflag == FTW_SL) {
         ssize_t len = readlink(fpath, target, PATH_MAX - 1);
@@ -193,7 +253,7 @@ static int nftw_handler(const char *fpath, const struct stat *finfo,
         }
         target[len] = '\0';
         // Get the relative path of the target of the symlink
-        file.target_relpath = target + basepath_len;
+        file.target_relpath = arena_strdup(&scan_arena, target + basepath_len);
     }
     memset(&file.attrs, 0, sizeof(file.attrs));
     // stat buffer "finfo" gives info from stat(), etc. 
@@ -215,7 +275,7 @@ static int nftw_handler(const char *fpath, const struct stat *finfo,
     file.attrs.gid = finfo->st_gid;
     file._attrs.blksize = finfo->st_blksize;
     file._attrs.blocks = finfo->st_blocks;
-    walker_files.push_back(file);
+    walker_files.push_back(&file);
     return FTW_CONTINUE;
 }
 
@@ -224,6 +284,8 @@ static int do_walk(const char *basepath, printer_t printer) {
     walker_basepath = basepath;
     basepath_len = strnlen(basepath, PATH_MAX);
     walker_files.clear();
+    pool_reset(&file_pool);
+    arena_reset(&scan_arena);
     walker_printer = printer;
 
     // walk the directory tree
@@ -250,16 +312,17 @@ static int walk(const char *path, const char *abstract_path, absfs_t *fs,
     }
 
     // sort the file list
-    std::vector<AbstractFile> &files = walker_files;
-    auto abspath_cmp = [](const AbstractFile &a, const AbstractFile &b) {
-        return a.abstract_path < b.abstract_path;
+    std::vector<AbstractFile *> &files = walker_files;
+    auto abspath_cmp = [](const AbstractFile *a, const AbstractFile *b) {
+        return strcmp(a->abstract_path, b->abstract_path) < 0;
     };
     std::sort(files.begin(), files.end(), abspath_cmp);
 
     // iterate the file list and compute the hash
-    for (AbstractFile &file : files) {
+    for (AbstractFile *pfile : files) {
+        AbstractFile &file = *pfile;
         if (verbose) {
-            verbose_printer("%s, mode=", file.abstract_path.c_str());
+            verbose_printer("%s, mode=", file.abstract_path);
             print_filemode(verbose_printer, file.attrs.mode);
             verbose_printer(", size=%zu", file.attrs.size);
             if (!S_ISREG(file.attrs.mode))
@@ -277,25 +340,44 @@ static int walk(const char *path, const char *abstract_path, absfs_t *fs,
 }
 
 void AbstractFile::FeedHasher(absfs_t *absfs) {
-    const char *abspath = abstract_path.c_str();
-    size_t pathlen = strnlen(abspath, PATH_MAX);
+    absfs_feed_file(absfs, abstract_path, target_relpath,
+                    &attrs);
+    if (hash_xattrs) {
+        struct arena_mark mark = arena_get_mark(&scan_arena);
+        hash_file_xattrs(this, absfs, &scan_arena);
+        arena_rewind(&scan_arena, mark);
+    }
+    if (S_ISREG(attrs.mode))
+        hash_file_content(this, absfs);
+}
 
-    const char *tgt_relpath = target_relpath.c_str();
+/**
+ * absfs_feed_file: Feed the path and attributes of a file into the hash
+ *   calculator.  This is the canonical encoding of a file in the abstract
+ *   state, and the content of a regular file should be fed right after it
+ *   by absfs_feed_content().
+ */
+void absfs_feed_file(absfs_t *absfs, const char *abspath,
+                     const char *tgt_relpath,
+                     const struct absfs_attrs *fattrs) {
+    size_t pathlen = strnlen(abspath, PATH_MAX);
     size_t tgtlen = strnlen(tgt_relpath, PATH_MAX);
 
+    /* Zero the padding so that it does not leak into the hash */
+    struct absfs_attrs attrs;
+    memset(&attrs, 0, sizeof(attrs));
+    attrs.mode = fattrs->mode;
     /* We only take file sizes of regular files into consideration,
      * because different file systems may have different behavior in
      * reporting special files' sizes (especially directories), which
      * is normal but will cause false discrepancy.
      */
-    size_t fsize = attrs.size;
-    /* Don't add `attrs.nlink = 0;` to the condition below 
-     * because we handled the nlink for root dir specially
-     * for ext4.
-     */
-    if (!S_ISREG(attrs.mode)) {
-        attrs.size = 0;
-    }
+    attrs.size = S_ISREG(fattrs->mode) ? fattrs->size : 0;
+    /* nlink is taken as is, because the caller has handled the nlink
+     * of the root dir specially for ext4. */
+    attrs.nlink = fattrs->nlink;
+    attrs.uid = fattrs->uid;
+    attrs.gid = fattrs->gid;
 
     switch (absfs->hash_option) {
         case xxh128_t: {
@@ -330,12 +412,64 @@ void AbstractFile::FeedHasher(absfs_t *absfs) {
             break;
         }
     }
+}
 
-    if (S_ISREG(attrs.mode))
-        hash_file_content(this, absfs);
+/**
+ * absfs_feed_content: Feed a chunk of file content into the hash
+ *   calculator.
+ *
+ * @return: 0 for success, +1 for hash update failure
+ */
+int absfs_feed_content(absfs_t *absfs, const void *buf, size_t len) {
+    int ret = 0;
+    switch (absfs->hash_option) {
+        case xxh128_t: {
+            ret = (XXH3_128bits_update(absfs->xxh_state, buf, len) != XXH_ERROR);
+            break;
+        }
+        case xxh3_t: {
+            ret = (XXH3_64bits_update(absfs->xxh_state, buf, len) != XXH_ERROR);
+            break;
+        }
+        case md5_t: {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+            ret = EVP_DigestUpdate(absfs->md5_state, buf, len);
+#else
+            ret = MD5_Update(&absfs->md5_state, buf, len);
+#endif
+            break;
+        }
+        case crc32_t: {
+            ret = (int)
+                    (absfs->crc32_state = crc32((uLong) absfs->crc32_state, (const Bytef *) buf,
+                                                (uInt) len));
+            break;
+        }
+        default: {
+            fprintf(stderr, "Hash option not supported\n");
+            exit(1);
+            break;
+        }
+    }
+    /* MD5_Update returns 0 for failure and 1 for success.
+     * However, we want 0 for success and other values for error.
+     */
+    return (ret == 0) ? 1 : 0;
+}
 
-    /* Assign value back after use */
-    attrs.size = fsize;
+/**
+ * absfs_feed_xattr: Feed one extended attribute of the file last fed by
+ *   absfs_feed_file() into the hash calculator.  The name goes in with its
+ *   terminating NUL and the value with its length, so that the encoding of
+ *   a sequence of attributes is unambiguous.
+ */
+void absfs_feed_xattr(absfs_t *absfs, const char *name, const void *value,
+                      size_t len) {
+    uint64_t vlen = len;
+    absfs_feed_content(absfs, name, strlen(name) + 1);
+    absfs_feed_content(absfs, &vlen, sizeof(vlen));
+    if (len > 0)
+        absfs_feed_content(absfs, value, len);
 }
 
 /**
@@ -349,19 +483,19 @@ bool AbstractFile::CheckValidity() {
     /* The file must be either a regular file or a directory */
     if (!(S_ISREG(attrs.mode) ^ S_ISDIR(attrs.mode))) {
         printer("File %s must be either a regular file or a directory.\n",
-                fullpath.c_str());
+                fullpath);
         res = false;
     }
     /* The file size should not exceed 1M */
     if (attrs.size > 1048576) {
         printer("File %s has size of %zu, which is unlikely in our experiment.\n",
-                fullpath.c_str());
+                fullpath);
         res = false;
     }
     /* nlink shouldn't be too large */
     if (attrs.nlink > 5) {
         printer("File %s has %d links, which is unlikely in our experiment.\n",
-                fullpath.c_str());
+                fullpath);
         res = false;
     }
     /* File size should match number of blocks allocated */
@@ -369,7 +503,7 @@ bool AbstractFile::CheckValidity() {
     size_t allocated = (size_t) _attrs.blksize * _attrs.blocks;
     if (allocated - rounded_fsize > 4096) {
         printer("File %s has the size of %zu, but is allocated %zu bytes.\n",
-                fullpath.c_str(), attrs.size, allocated);
+                fullpath, attrs.size, allocated);
         res = false;
     }
     return res;
@@ -400,7 +534,7 @@ void AbstractFile::retry_warning(const std::string &funcname, const std::string
 }
 
 int AbstractFile::Open(int flag) {
-    DEFINE_SYSCALL_WITH_RETRY(int, open, fullpath.c_str(), flag);
+    DEFINE_SYSCALL_WITH_RETRY(int, open, fullpath, flag);
 }
 
 ssize_t AbstractFile::Read(int fd, void *buf, size_t count) {
@@ -408,14 +542,14 @@ ssize_t AbstractFile::Read(int fd, void *buf, size_t count) {
 }
 
 int AbstractFile::Lstat(struct stat *statbuf) {
-    DEFINE_SYSCALL_WITH_RETRY(int, lstat, fullpath.c_str(), statbuf);
+    DEFINE_SYSCALL_WITH_RETRY(int, lstat, fullpath, statbuf);
 }
 
 DIR *AbstractFile::Opendir() {
     if (!S_ISDIR(attrs.mode)) {
         return nullptr;
     }
-    DEFINE_SYSCALL_WITH_RETRY(DIR *, opendir, fullpath.c_str());
+    DEFINE_SYSCALL_WITH_RETRY(DIR *, opendir, fullpath);
 }
 
 struct dirent *AbstractFile::Readdir(DIR *dirp) {
@@ -476,6 +610,17 @@ void destroy_abstract_fs(absfs_t *absfs) {
     }
 }
 
+static void __attribute__((constructor)) abstract_fs_init() {
+    pool_init(&file_pool, sizeof(AbstractFile), 256);
+}
+
+/* The scan pool and arena are shared by all the scans, so they go with the
+ * process */
+static void __attribute__((destructor)) abstract_fs_exit() {
+    pool_destroy(&file_pool);
+    arena_destroy(&scan_arena);
+}
+
 /**
  * scan_abstract_fs: Walk the directory tree starting from the given
  *   basepath, and calculate a MD5 hash as the "abstract file system
@@ -489,6 +634,18 @@ void destroy_abstract_fs(absfs_t *absfs) {
 int scan_abstract_fs(absfs_t *absfs, const char *basepath, bool verbose,
                      printer_t verbose_printer) {
     int ret = walk(basepath, "/", absfs, verbose, verbose_printer);
+    int digest_ret = digest_abstract_fs(absfs);
+    return (digest_ret != 0) ? digest_ret : ret;
+}
+
+/**
+ * digest_abstract_fs: Finalize the hash calculator and store the
+ *   abstract state in absfs->state.
+ *
+ * @return: 0 for success, -1 for unknown hash option
+ */
+int digest_abstract_fs(absfs_t *absfs) {
+    int ret = 0;
     //0:xxh128,1:xxh3,2:md5,3:crc64
     switch (absfs->hash_option) {
         case xxh128_t: {
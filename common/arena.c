@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2020-2024 Yifei Liu
+ * Copyright (c) 2020-2024 Wei Su
+ * Copyright (c) 2020-2024 Erez Zadok
+ * Copyright (c) 2020-2024 Stony Brook University
+ * Copyright (c) 2020-2024 The Research Foundation of SUNY
+ *
+ * You can redistribute it and/or modify it under the terms of the Apache
+ * License, Version 2.0 (http://www.apache.org/licenses/LICENSE-2.0).
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define ARENA_HDR_SIZE \
+    ((sizeof(struct arena_block) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+static inline char *block_begin(struct arena_block *b)
+{
+    return (char *)b + ARENA_HDR_SIZE;
+}
+
+static inline char *block_end(struct arena_block *b)
+{
+    return block_begin(b) + b->size;
+}
+
+void arena_init(struct arena *a, size_t block_size)
+{
+    a->blocks = NULL;
+    a->spare = NULL;
+    a->cur = a->end = NULL;
+    a->block_size = block_size ? block_size : ARENA_DEFAULT_BLOCK;
+}
+
+static void free_blocks(struct arena_block *b)
+{
+    while (b) {
+        struct arena_block *next = b->next;
+        free(b);
+        b = next;
+    }
+}
+
+void arena_destroy(struct arena *a)
+{
+    free_blocks(a->blocks);
+    free_blocks(a->spare);
+    arena_init(a, a->block_size);
+}
+
+/* Make a block with at least size bytes the current one */
+static bool arena_grow(struct arena *a, size_t size)
+{
+    struct arena_block *b = NULL;
+    /* Take a spare block if one is large enough */
+    for (struct arena_block **p = &a->spare; *p; p = &(*p)->next) {
+        if ((*p)->size >= size) {
+            b = *p;
+            *p = b->next;
+            break;
+        }
+    }
+    if (!b) {
+        size_t bsize = a->block_size ? a->block_size : ARENA_DEFAULT_BLOCK;
+        if (bsize < size)
+            bsize = size;
+        b = malloc(ARENA_HDR_SIZE + bsize);
+        if (!b)
+            return false;
+        b->size = bsize;
+    }
+    b->next = a->blocks;
+    a->blocks = b;
+    a->cur = block_begin(b);
+    a->end = block_end(b);
+    return true;
+}
+
+void *arena_alloc(struct arena *a, size_t size)
+{
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if ((size_t)(a->end - a->cur) < size && !arena_grow(a, size))
+        return NULL;
+    void *ptr = a->cur;
+    a->cur += size;
+    return ptr;
+}
+
+char *arena_strndup(struct arena *a, const char *s, size_t n)
+{
+    size_t len = strnlen(s, n);
+    char *copy = arena_alloc(a, len + 1);
+    if (copy) {
+        memcpy(copy, s, len);
+        copy[len] = '\0';
+    }
+    return copy;
+}
+
+char *arena_strdup(struct arena *a, const char *s)
+{
+    return arena_strndup(a, s, SIZE_MAX);
+}
+
+void arena_reset(struct arena *a)
+{
+    struct arena_mark empty = {NULL, NULL};
+    arena_rewind(a, empty);
+}
+
+struct arena_mark arena_get_mark(struct arena *a)
+{
+    struct arena_mark mark = {a->blocks, a->cur};
+    return mark;
+}
+
+/* Release everything allocated after the mark was taken */
+void arena_rewind(struct arena *a, struct arena_mark mark)
+{
+    while (a->blocks != mark.block) {
+        struct arena_block *b = a->blocks;
+        assert(b);
+        a->blocks = b->next;
+        b->next = a->spare;
+        a->spare = b;
+    }
+    if (mark.block) {
+        a->cur = mark.cur;
+        a->end = block_end(mark.block);
+    } else {
+        a->cur = a->end = NULL;
+    }
+}
+
+void pool_init(struct pool *p, size_t objsize, size_t objs_per_block)
+{
+    /* A free object holds the link of the free list */
+    if (objsize < sizeof(void *))
+        objsize = sizeof(void *);
+    p->objsize = (objsize + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    arena_init(&p->arena, p->objsize * (objs_per_block ? objs_per_block : 64));
+    p->free_list = NULL;
+    p->nused = 0;
+}
+
+void pool_destroy(struct pool *p)
+{
+    arena_destroy(&p->arena);
+    p->free_list = NULL;
+    p->nused = 0;
+}
+
+void *pool_get(struct pool *p)
+{
+    void *obj = p->free_list;
+    if (obj)
+        p->free_list = *(void **)obj;
+    else
+        obj = arena_alloc(&p->arena, p->objsize);
+    if (obj)
+        p->nused++;
+    return obj;
+}
+
+void pool_put(struct pool *p, void *obj)
+{
+    if (!obj)
+        return;
+    *(void **)obj = p->free_list;
+    p->free_list = obj;
+    p->nused--;
+}
+
+void pool_reset(struct pool *p)
+{
+    arena_reset(&p->arena);
+    p->free_list = NULL;
+    p->nused = 0;
+}
@@ -19,26 +19,69 @@ void circular_buf_init(circular_buf_sum_t **fsimg_bufs, int n_fs, size_t *devsiz
 
     // init circular_buf
     for(int i = 0; i < n_fs; ++i) {
+        size_t npages = (devsize_kb[i] * KB_TO_BYTES + CBUF_PAGE_SIZE - 1) /
+                        CBUF_PAGE_SIZE;
+        size_t nwords = CBUF_BITMAP_WORDS(npages);
         (*fsimg_bufs)->cir_bufs[i].head_idx = 0;
         (*fsimg_bufs)->cir_bufs[i].size = 0;
+        (*fsimg_bufs)->cir_bufs[i].npages = npages;
         // init fsimg_buf
         for (int j = 0; j < CBUF_SIZE; ++j) {
             (*fsimg_bufs)->cir_bufs[i].img_buf[j].state = calloc(1, devsize_kb[i] * KB_TO_BYTES);
             (*fsimg_bufs)->cir_bufs[i].img_buf[j].ckpt = true;
             (*fsimg_bufs)->cir_bufs[i].img_buf[j].depth = 0;
             (*fsimg_bufs)->cir_bufs[i].img_buf[j].seqid = 0;
+            // An empty slot differs from the device everywhere
+            (*fsimg_bufs)->cir_bufs[i].stale[j] = malloc(nwords * sizeof(uint64_t));
+            memset((*fsimg_bufs)->cir_bufs[i].stale[j], 0xff,
+                   nwords * sizeof(uint64_t));
         }
     }
 }
 
+/*
+ * Bring the slot up to date with the device, copying only the pages that
+ * changed since the slot was last written.  dirty has the pages written
+ * since the previous insertion, or is NULL if they are unknown.
+ */
+static void copy_stale_pages(circular_buf_t *cbuf, size_t slot,
+                             size_t imgsz, const char *save_state,
+                             const uint64_t *dirty)
+{
+    size_t nwords = CBUF_BITMAP_WORDS(cbuf->npages);
+    char *img = cbuf->img_buf[slot].state;
+
+    for (int j = 0; j < CBUF_SIZE; ++j) {
+        for (size_t w = 0; w < nwords; ++w)
+            cbuf->stale[j][w] |= dirty ? dirty[w] : ~(uint64_t)0;
+    }
+
+    for (size_t w = 0; w < nwords; ++w) {
+        uint64_t bits = cbuf->stale[slot][w];
+        while (bits) {
+            size_t page = w * 64 + __builtin_ctzll(bits);
+            size_t off = page * CBUF_PAGE_SIZE;
+            bits &= bits - 1;
+            if (off >= imgsz)
+                break;
+            size_t len = imgsz - off;
+            if (len > CBUF_PAGE_SIZE)
+                len = CBUF_PAGE_SIZE;
+            memcpy(img + off, save_state + off, len);
+        }
+        cbuf->stale[slot][w] = 0;
+    }
+}
+
 void insert_circular_buf(circular_buf_sum_t *fsimg_bufs, int fs_idx, 
                             size_t devsize_kb, void *save_state, 
+                            const uint64_t *dirty,
                             size_t state_depth, size_t seq_id, bool is_ckpt) 
 {
     size_t head = fsimg_bufs->cir_bufs[fs_idx].head_idx;
 
-    memcpy(fsimg_bufs->cir_bufs[fs_idx].img_buf[head].state, save_state, 
-        devsize_kb * KB_TO_BYTES);
+    copy_stale_pages(&fsimg_bufs->cir_bufs[fs_idx], head,
+                     devsize_kb * KB_TO_BYTES, save_state, dirty);
     fsimg_bufs->cir_bufs[fs_idx].img_buf[head].depth = state_depth;
     fsimg_bufs->cir_bufs[fs_idx].img_buf[head].seqid = seq_id;
     fsimg_bufs->cir_bufs[fs_idx].img_buf[head].ckpt = is_ckpt;
@@ -114,6 +157,7 @@ void cleanup_cir_bufs(circular_buf_sum_t *fsimg_bufs)
         for(size_t j = 0; j < CBUF_SIZE; ++j) {
             if (fsimg_bufs->cir_bufs[i].img_buf[j].state)
                 free(fsimg_bufs->cir_bufs[i].img_buf[j].state);
+            free(fsimg_bufs->cir_bufs[i].stale[j]);
         }
     }
 
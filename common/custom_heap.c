@@ -8,11 +8,15 @@
  * You can redistribute it and/or modify it under the terms of the Apache
  * License, Version 2.0 (http://www.apache.org/licenses/LICENSE-2.0).
  */
- 
+
 #include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <errno.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
@@ -21,16 +25,54 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <stddef.h>
-#include <malloc.h>
 
 #include "custom_heap.h"
 
 static char *custom_heap_path;
 static ssize_t custom_heap_size;
-static const char *custom_heap_path_key = "CUSTOM_HEAP_PATH";
+static const char *custom_heap_path_key = CUSTOM_HEAP_PATH_ENV;
 static void *myheap_base;
 static int myheap_fd = -1;
 
+/*
+ * The heap is carved from the mapping with a bump pointer.  Every chunk
+ * starts with a 16-byte header, so payloads are 16-byte aligned.  Small
+ * chunks are rounded up to a size class and recycled through one free list
+ * per class; large chunks (more than HEAP_MAX_SMALL bytes) are page-sized
+ * multiples, recycled by best fit and split when much larger than needed.
+ * Free chunks are not coalesced: the model checker allocates the same few
+ * sizes over and over, so the free lists reach a steady state quickly.
+ */
+#define HEAP_MAX_SMALL 4096
+#define HEAP_LARGE_UNIT 4096
+#define HEAP_LARGE_CLASS 0xffffffffU
+#define HEAP_CHUNK_MAGIC 0x4d434853U /* "MCHS" */
+
+struct heap_chunk {
+    uint64_t size;  /* payload bytes */
+    uint32_t cls;   /* index into class_sizes or HEAP_LARGE_CLASS */
+    uint32_t magic;
+};
+
+struct free_chunk {
+    struct heap_chunk hdr;
+    struct free_chunk *next;
+};
+
+static const size_t class_sizes[] = {
+    16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048,
+    3072, 4096,
+};
+#define HEAP_NCLASSES (sizeof(class_sizes) / sizeof(class_sizes[0]))
+
+static char *heap_top;
+static char *heap_end;
+static struct free_chunk *small_free[HEAP_NCLASSES];
+static struct free_chunk *large_free;
+static size_t heap_in_use;
+static bool heap_full_warned;
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /* Get the size of a file or block device */
 static inline ssize_t fsize(const char *fpath)
 {
@@ -43,10 +85,10 @@ static inline ssize_t fsize(const char *fpath)
                 __func__, fpath, errno);
         goto end;
     }
-    if (info.st_mode & __S_IFREG) {
+    if (S_ISREG(info.st_mode)) {
         ret = info.st_size;
         goto end;
-    } else if (info.st_mode & __S_IFBLK) {
+    } else if (S_ISBLK(info.st_mode)) {
         size_t devsz;
         ret = ioctl(fd, BLKGETSIZE64, &devsz);
         if (ret != 0) {
@@ -66,12 +108,21 @@ end:
 
 static int get_params_from_env(void)
 {
+    const char *size_str = getenv(CUSTOM_HEAP_SIZE_ENV);
+
     custom_heap_path = getenv(custom_heap_path_key);
 
-    /* Validate existence of environment vars */
+    /* Without a file, an anonymous mapping of the given size is used */
     if (!custom_heap_path) {
-        fprintf(stderr, "%s is not set.\n", custom_heap_path_key);
-        return -EINVAL;
+        if (!size_str)
+            return -ENOENT;
+        custom_heap_size = strtoll(size_str, NULL, 0) << 20;
+        if (custom_heap_size <= 0) {
+            fprintf(stderr, "%s must be a positive number of MiB.\n",
+                    CUSTOM_HEAP_SIZE_ENV);
+            return -EINVAL;
+        }
+        return 0;
     }
 
     /* The file must be accessible */
@@ -95,24 +146,54 @@ static int get_params_from_env(void)
     return 0;
 }
 
-/* Map the custom heap file into address space.
+/* Map the custom heap file (or anonymous memory) into address space.
  * get_params_from_env() must be called first to get parameters */
 static int setup_myheap(void)
 {
-    myheap_fd = open(custom_heap_path, O_RDWR);
-    assert(myheap_fd >= 0);
+    const char *huge = getenv(CUSTOM_HEAP_HUGE_ENV);
+    bool hugetlb = huge && strcmp(huge, "hugetlb") == 0;
+    bool thp = huge && strcmp(huge, "thp") == 0;
 
-    myheap_base = mmap(NULL, custom_heap_size, PROT_READ | PROT_WRITE,
-            MAP_SHARED, myheap_fd, 0);
+    if (custom_heap_path) {
+        /* A file on hugetlbfs is backed by huge pages already */
+        myheap_fd = open(custom_heap_path, O_RDWR);
+        assert(myheap_fd >= 0);
+        myheap_base = mmap(NULL, custom_heap_size, PROT_READ | PROT_WRITE,
+                MAP_SHARED, myheap_fd, 0);
+    } else {
+        myheap_base = MAP_FAILED;
+        if (hugetlb) {
+            myheap_base = mmap(NULL, custom_heap_size,
+                    PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (myheap_base == MAP_FAILED)
+                fprintf(stderr, "%s: no huge pages reserved (%d), using "
+                        "normal pages.\n", __func__, errno);
+        }
+        if (myheap_base == MAP_FAILED)
+            myheap_base = mmap(NULL, custom_heap_size,
+                    PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    }
     if (myheap_base == MAP_FAILED) {
+        myheap_base = NULL;
         return -errno;
     }
+    if (thp && madvise(myheap_base, custom_heap_size, MADV_HUGEPAGE) != 0)
+        fprintf(stderr, "%s: madvise(MADV_HUGEPAGE) failed (%d).\n",
+                __func__, errno);
+
+    heap_top = myheap_base;
+    heap_end = (char *)myheap_base + custom_heap_size;
     return 0;
 }
 
 void try_init_myheap(void)
 {
     int ret = get_params_from_env();
+    /* The custom heap is optional */
+    if (ret == -ENOENT && !custom_heap_path)
+        return;
     if (ret != 0) {
         fprintf(stderr, "%s: env is not set properly.\n", __func__);
         return;
@@ -123,8 +204,6 @@ void try_init_myheap(void)
                 __func__, ret);
         return;
     }
-
-    // __morecore = my_morecore;
 }
 
 void unset_myheap(void)
@@ -133,26 +212,187 @@ void unset_myheap(void)
         munmap(myheap_base, custom_heap_size);
     if (myheap_fd >= 0)
         close(myheap_fd);
+    myheap_base = NULL;
+    myheap_fd = -1;
+    heap_top = heap_end = NULL;
+}
+
+bool myheap_ready(void)
+{
+    return myheap_base != NULL;
+}
+
+size_t myheap_in_use(void)
+{
+    return heap_in_use;
+}
+
+bool myheap_owns(const void *ptr)
+{
+    return myheap_base != NULL && (const char *)ptr >= (char *)myheap_base &&
+           (const char *)ptr < heap_end;
+}
+
+static int size_class(size_t size)
+{
+    int lo = 0, hi = HEAP_NCLASSES - 1;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (class_sizes[mid] < size)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static struct heap_chunk *bump(size_t payload)
+{
+    size_t total = sizeof(struct heap_chunk) + payload;
+    if ((size_t)(heap_end - heap_top) < total)
+        return NULL;
+    struct heap_chunk *chunk = (struct heap_chunk *)heap_top;
+    heap_top += total;
+    chunk->size = payload;
+    chunk->magic = HEAP_CHUNK_MAGIC;
+    return chunk;
 }
 
-void *my_morecore(ptrdiff_t increment)
+static struct heap_chunk *alloc_large(size_t size)
 {
-    static void *current = NULL;
-    void *result;
+    size_t payload = (size + HEAP_LARGE_UNIT - 1) & ~(size_t)(HEAP_LARGE_UNIT - 1);
+    struct free_chunk **best = NULL;
 
-    if (current == NULL) {
-        if (myheap_base == NULL) {
-            fprintf(stderr, "%s: please set up the custom heap first.\n",
-                    __func__);
-            abort();
+    for (struct free_chunk **p = &large_free; *p; p = &(*p)->next) {
+        if ((*p)->hdr.size >= payload &&
+            (!best || (*p)->hdr.size < (*best)->hdr.size))
+            best = p;
+    }
+    if (!best) {
+        struct heap_chunk *chunk = bump(payload);
+        if (chunk)
+            chunk->cls = HEAP_LARGE_CLASS;
+        return chunk;
+    }
+
+    struct free_chunk *chunk = *best;
+    *best = chunk->next;
+    /* Give the tail back if it can hold another large chunk */
+    if (chunk->hdr.size >= payload + sizeof(struct heap_chunk) +
+                           HEAP_LARGE_UNIT) {
+        struct free_chunk *rest = (struct free_chunk *)
+            ((char *)(&chunk->hdr + 1) + payload);
+        rest->hdr.size = chunk->hdr.size - payload - sizeof(struct heap_chunk);
+        rest->hdr.cls = HEAP_LARGE_CLASS;
+        rest->hdr.magic = HEAP_CHUNK_MAGIC;
+        rest->next = large_free;
+        large_free = rest;
+        chunk->hdr.size = payload;
+    }
+    return &chunk->hdr;
+}
+
+static struct heap_chunk *alloc_chunk(size_t size)
+{
+    if (size > HEAP_MAX_SMALL)
+        return alloc_large(size);
+
+    int cls = size_class(size ? size : 1);
+    struct heap_chunk *chunk;
+    if (small_free[cls]) {
+        chunk = &small_free[cls]->hdr;
+        small_free[cls] = small_free[cls]->next;
+        return chunk;
+    }
+    chunk = bump(class_sizes[cls]);
+    if (chunk)
+        chunk->cls = cls;
+    return chunk;
+}
+
+static void free_chunk(struct heap_chunk *chunk)
+{
+    struct free_chunk *fc = (struct free_chunk *)chunk;
+    assert(chunk->magic == HEAP_CHUNK_MAGIC);
+    if (chunk->cls == HEAP_LARGE_CLASS) {
+        fc->next = large_free;
+        large_free = fc;
+    } else {
+        fc->next = small_free[chunk->cls];
+        small_free[chunk->cls] = fc;
+    }
+}
+
+/*
+ * Allocate from the custom heap.  Before try_init_myheap() succeeds, or
+ * once the heap is exhausted, this falls back to the libc allocator, so
+ * myheap_free() and myheap_realloc() accept pointers from either.
+ */
+void *myheap_malloc(size_t size)
+{
+    struct heap_chunk *chunk = NULL;
+
+    if (!myheap_base)
+        return malloc(size);
+    pthread_mutex_lock(&heap_lock);
+    chunk = alloc_chunk(size);
+    if (chunk)
+        heap_in_use += chunk->size;
+    pthread_mutex_unlock(&heap_lock);
+    if (!chunk) {
+        if (!heap_full_warned) {
+            heap_full_warned = true;
+            fprintf(stderr, "%s: the custom heap (%zd bytes) is full, "
+                    "falling back to malloc.\n", __func__, custom_heap_size);
         }
-        current = myheap_base;
+        return malloc(size);
     }
+    return chunk + 1;
+}
 
-    if (current + increment > myheap_base + custom_heap_size) {
+void *myheap_calloc(size_t nmemb, size_t size)
+{
+    size_t total;
+    if (__builtin_mul_overflow(nmemb, size, &total)) {
+        errno = ENOMEM;
         return NULL;
     }
-    result = current;
-    current += increment;
-    return result;
+    void *ptr = myheap_malloc(total);
+    /* A file-backed heap holds whatever the file had */
+    if (ptr && myheap_owns(ptr))
+        memset(ptr, 0, total);
+    return ptr;
+}
+
+void myheap_free(void *ptr)
+{
+    if (!ptr)
+        return;
+    if (!myheap_owns(ptr)) {
+        free(ptr);
+        return;
+    }
+    struct heap_chunk *chunk = (struct heap_chunk *)ptr - 1;
+    pthread_mutex_lock(&heap_lock);
+    heap_in_use -= chunk->size;
+    free_chunk(chunk);
+    pthread_mutex_unlock(&heap_lock);
+}
+
+void *myheap_realloc(void *ptr, size_t size)
+{
+    if (!ptr)
+        return myheap_malloc(size);
+    if (!myheap_owns(ptr))
+        return realloc(ptr, size);
+
+    struct heap_chunk *chunk = (struct heap_chunk *)ptr - 1;
+    if (size <= chunk->size)
+        return ptr;
+    void *newptr = myheap_malloc(size);
+    if (newptr) {
+        memcpy(newptr, ptr, chunk->size);
+        myheap_free(ptr);
+    }
+    return newptr;
 }
@@ -14,6 +14,8 @@
 #include <signal.h>
 
 #include "log.h"
+#include "arena.h"
+#include "stack.h"
 
 /* Config values */
 static size_t log_queue_init_size = 10240;
@@ -21,13 +23,22 @@ static size_t log_queue_init_size = 10240;
  * rotate the log */
 static size_t logfile_size_limit = 1024 * 1024 * 1024;
 static int log_daemon_interval = 1;
+#define LOG_STACKBUF_SIZE 1024
+#define LOG_ARENA_BLOCK (1024 * 1024)
 static int run_daemon = 0;
 
 static struct logger output;
 static struct logger error;
 static struct logger seq;
 
-static vector_t log_queue;
+DEFINE_STACK(log_entry_queue, struct log_entry)
+
+/* Two message queues and the arenas of their contents.  The daemon drains
+ * one pair while the other takes new logs, then clears the queue and
+ * resets the arena without freeing anything. */
+static struct log_entry_queue log_queues[2];
+static struct arena log_arenas[2];
+static int cur_queue;
 static pthread_t logd_id;
 static pthread_mutex_t loglock;
 
@@ -78,24 +89,22 @@ static void logrotate(struct logger *lgr)
 
 static void do_write_log(void)
 {
-    vector_t my_queue;
-    /* Lock the global message queue, and replace it with a new one */
+    struct log_entry_queue *my_queue;
+    struct arena *my_arena;
+    /* Lock the global message queue, and switch to the other one */
     pthread_mutex_lock(&loglock);
-    /* A shallow copy */
-    my_queue = log_queue;
-    /* Reinitialize the global msg queue */
-    vector_init(&log_queue, struct log_entry, log_queue_init_size);
-    assert(my_queue.data);
+    my_queue = &log_queues[cur_queue];
+    my_arena = &log_arenas[cur_queue];
+    cur_queue ^= 1;
     pthread_mutex_unlock(&loglock);
 
-    /* Iterate the copy of the message queue and write logs */
+    /* Iterate the drained message queue and write logs */
     struct log_entry *entry;
-    vector_iter(&my_queue, struct log_entry, entry) {
+    stack_foreach(my_queue, entry) {
         ssize_t ret = fwrite(entry->content, 1, entry->loglen,
                 entry->dest->file);
         assert(ret >= 0);
         fflush(entry->dest->file);
-        free(entry->content);
         entry->content = NULL;
         entry->loglen = 0;
         entry->dest->bytes_written += ret;
@@ -105,7 +114,8 @@ static void do_write_log(void)
         }
     }
 
-    vector_destroy(&my_queue);
+    log_entry_queue_clear(my_queue);
+    arena_reset(my_arena);
 }
 
 static void *log_daemon(void *arg)
@@ -128,25 +138,35 @@ static int _submit_log(struct logger *dest, const char *fmt, va_list args)
     struct log_entry ent;
     int ret;
     va_list args2;
+    char stackbuf[LOG_STACKBUF_SIZE];
+    char *heapbuf = NULL;
 
     va_copy(args2, args);
-    /* Get the length first, then allocate space for the content */
-    ret = vsnprintf(NULL, 0, fmt, args);
+    /* Most logs fit the stack buffer, so they are formatted only once */
+    ret = vsnprintf(stackbuf, sizeof(stackbuf), fmt, args);
     if (ret < 0)
         return ret;
-    ent.content = malloc(ret + 1);
-    if (ent.content == NULL)
-        return -ENOMEM;
-    /* Fill content to the allocated space */
-    vsprintf(ent.content, fmt, args2);
+    if ((size_t)ret >= sizeof(stackbuf)) {
+        heapbuf = malloc(ret + 1);
+        if (heapbuf == NULL)
+            return -ENOMEM;
+        vsprintf(heapbuf, fmt, args2);
+    }
+    va_end(args2);
     ent.loglen = ret;
     ent.dest = dest;
 
-    /* Insert the log into the message queue */
+    /* Copy the log into the arena and insert it into the message queue */
     pthread_mutex_lock(&loglock);
-    vector_add(&log_queue, &ent);
+    ent.content = arena_alloc(&log_arenas[cur_queue], ret + 1);
+    if (ent.content) {
+        memcpy(ent.content, heapbuf ? heapbuf : stackbuf, ret + 1);
+        if (log_entry_queue_push(&log_queues[cur_queue], ent) != 0)
+            ent.content = NULL;
+    }
     pthread_mutex_unlock(&loglock);
-    return ret;
+    free(heapbuf);
+    return ent.content ? ret : -ENOMEM;
 }
 
 int submit_log(struct logger *dest, const char *fmt, ...)
@@ -250,6 +270,8 @@ void destroy_log_daemon()
     run_daemon = 0;
     pthread_join(logd_id, NULL);
     do_write_log();
+    arena_destroy(&log_arenas[0]);
+    arena_destroy(&log_arenas[1]);
     pthread_mutex_destroy(&loglock);
 }
 
@@ -268,8 +290,11 @@ void init_log_daemon(const char *output_log_name, const char *err_log_name,
     signal(SIGSEGV, abort_handler);
     signal(SIGHUP, abort_handler);
 
-    /* Set up the message queue */
-    vector_init(&log_queue, struct log_entry, log_queue_init_size);
+    /* Set up the message queues */
+    log_entry_queue_reserve(&log_queues[0], log_queue_init_size);
+    log_entry_queue_reserve(&log_queues[1], log_queue_init_size);
+    arena_init(&log_arenas[0], LOG_ARENA_BLOCK);
+    arena_init(&log_arenas[1], LOG_ARENA_BLOCK);
 
     /* Spawn log daemon thread */
     ret = pthread_attr_init(&logd_attrs);
@@ -11,12 +11,17 @@
 
 #define _GNU_SOURCE
 #include "operations.h"
+#include "prng.h"
 
 #include <stdio.h>
 #include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <sys/mman.h>
+#include <pthread.h>
 
 inputs_t *inputs_t_p = NULL;
 
@@ -29,6 +34,16 @@ double inv_rzdFlagPercent[MAX_FLAG_BITS] = {0};
 double rzdWriteSizePrecent[WRITE_SIZE_PARTS] = {0};
 double inv_rzdWriteSizePrecent[WRITE_SIZE_PARTS] = {0};
 
+/*
+ * The distributions above compiled by syscall_inputs_init() for sampling:
+ * flag bit i of a pattern is set iff a PRNG_DRAW_BITS-bit draw is less than
+ * flag_thresh[pattern][i], and
+ * only the bits in flag_candidates[pattern] can be set at all.
+ */
+static uint64_t flag_thresh[OPEN_FLAG_PATTERNS][MAX_FLAG_BITS];
+static uint32_t flag_candidates[OPEN_FLAG_PATTERNS];
+static alias_table_t writesz_alias[WRITE_SIZE_PATTERNS];
+
 // Based on the kernel ocurrence probability 
 const double flagBitPercent[MAX_FLAG_BITS] = {
     10.12, //	O_WRONLY	0
@@ -108,6 +123,81 @@ exit_err:
     return -1;
 }
 
+/*
+ * Pre-generated write data.  Slot b holds WRITE_POOL_MAX_SIZE bytes of value
+ * b; it is filled on first use (and extended when a longer write comes), so
+ * the reserved but unused slots cost no memory.  The concurrent mode writes
+ * from several threads: the filled lengths are read atomically, and a slot
+ * is extended under write_pool_lock.
+ */
+static char *write_pool = NULL;
+static size_t write_pool_filled[256];
+static pthread_once_t write_pool_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t write_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void write_pool_map()
+{
+    void *pool = mmap(NULL, 256 * WRITE_POOL_MAX_SIZE, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (pool == MAP_FAILED) {
+        fprintf(stderr, "Error: cannot map the write pattern pool (%d)\n",
+                errno);
+        exit(1);
+    }
+    write_pool = pool;
+}
+
+void write_pool_init()
+{
+    pthread_once(&write_pool_once, write_pool_map);
+}
+
+/* Returns NULL if len is larger than WRITE_POOL_MAX_SIZE */
+const void *write_pool_get(int byte, size_t len)
+{
+    if (len > WRITE_POOL_MAX_SIZE)
+        return NULL;
+    write_pool_init();
+    byte &= 0xff;
+    char *slot = write_pool + byte * WRITE_POOL_MAX_SIZE;
+    if (__atomic_load_n(&write_pool_filled[byte], __ATOMIC_ACQUIRE) < len) {
+        /* Readers only use the filled prefix, which is left untouched */
+        pthread_mutex_lock(&write_pool_lock);
+        size_t filled = write_pool_filled[byte];
+        if (filled < len) {
+            memset(slot + filled, byte, len - filled);
+            __atomic_store_n(&write_pool_filled[byte], len, __ATOMIC_RELEASE);
+        }
+        pthread_mutex_unlock(&write_pool_lock);
+    }
+    return slot;
+}
+
+/* Write length bytes of value byte, as BYTE_REPEAT data does */
+ssize_t write_file_byte(const char *path, int flags, int byte, off_t offset, size_t length)
+{
+    void *data = (void *)write_pool_get(byte, length);
+    bool allocated = false;
+    ssize_t ret;
+    int err;
+
+    if (!data) {
+        data = malloc(length);
+        if (!data) {
+            errno = ENOMEM;
+            return -1;
+        }
+        memset(data, byte, length);
+        allocated = true;
+    }
+    ret = write_file(path, flags, data, offset, length);
+    err = errno;
+    if (allocated)
+        free(data);
+    errno = err;
+    return ret;
+}
+
 int fallocate_file(const char *path, off_t offset, off_t len)
 {
     int fd = open(path, O_RDWR);
@@ -208,9 +298,100 @@ void populate_writesz_parts()
     */
 }
 
+/* Threshold t such that prng_draw() < t has probability prob */
+static uint64_t prob_to_thresh(double prob)
+{
+    if (prob <= 0)
+        return 0;
+    if (prob >= 1)
+        return PRNG_DRAW_RANGE;
+    return (uint64_t)ceil(prob * PRNG_DRAW_RANGE);
+}
+
+void build_alias_table(alias_table_t *tbl, const double *weights, int n)
+{
+    double scaled[WRITE_SIZE_PARTS];
+    int small[WRITE_SIZE_PARTS], large[WRITE_SIZE_PARTS];
+    int nsmall = 0, nlarge = 0;
+    double total = 0.0;
+
+    for (int i = 0; i < n; i++) {
+        total += weights[i];
+    }
+    tbl->n = n;
+    for (int i = 0; i < n; i++) {
+        scaled[i] = weights[i] * n / total;
+        tbl->alias[i] = i;
+        if (scaled[i] < 1.0)
+            small[nsmall++] = i;
+        else
+            large[nlarge++] = i;
+    }
+    while (nsmall > 0 && nlarge > 0) {
+        int s = small[--nsmall];
+        int l = large[--nlarge];
+
+        tbl->thresh[s] = prob_to_thresh(scaled[s]);
+        tbl->alias[s] = l;
+        scaled[l] -= 1.0 - scaled[s];
+        if (scaled[l] < 1.0)
+            small[nsmall++] = l;
+        else
+            large[nlarge++] = l;
+    }
+    /* Whatever is left is 1.0 up to rounding errors */
+    while (nlarge > 0)
+        tbl->thresh[large[--nlarge]] = prob_to_thresh(1.0);
+    while (nsmall > 0)
+        tbl->thresh[small[--nsmall]] = prob_to_thresh(1.0);
+}
+
+int sample_alias_table(const alias_table_t *tbl)
+{
+    int i = (int)mcfs_prng_below(tbl->n);
+
+    return (prng_draw() < tbl->thresh[i]) ? i : tbl->alias[i];
+}
+
+static void compile_flag_pattern(int pattern, const double *percent,
+                                 double scale)
+{
+    flag_candidates[pattern] = 0;
+    for (int i = 0; i < MAX_FLAG_BITS; i++) {
+        flag_thresh[pattern][i] = prob_to_thresh(percent[i] * scale);
+        if (flag_thresh[pattern][i] > 0)
+            flag_candidates[pattern] |= 1U << i;
+    }
+}
+
+/* Compile all supported distributions into sampling tables */
+static void compile_input_distributions()
+{
+    double uniform[MAX_FLAG_BITS];
+    double uniform_sizes[WRITE_SIZE_PARTS];
+
+    for (int i = 0; i < MAX_FLAG_BITS; i++) {
+        uniform[i] = UNIFORM_FLAG_RATE;
+    }
+    compile_flag_pattern(0, uniform, 1);
+    compile_flag_pattern(1, flagBitPercent, PROB_FACTOR / 100.0);
+    compile_flag_pattern(2, whmFlagPercent, PROB_FACTOR / 100.0);
+    compile_flag_pattern(3, subFlagPercent, PROB_FACTOR / 100.0);
+    compile_flag_pattern(4, rzdFlagPercent, 1);
+    compile_flag_pattern(5, inv_rzdFlagPercent, 1);
+
+    for (int i = 0; i < WRITE_SIZE_PARTS; i++) {
+        uniform_sizes[i] = 1;
+    }
+    build_alias_table(&writesz_alias[0], uniform_sizes, WRITE_SIZE_PARTS);
+    build_alias_table(&writesz_alias[1], rzdWriteSizePrecent, WRITE_SIZE_PARTS);
+    build_alias_table(&writesz_alias[2], inv_rzdWriteSizePrecent,
+                      WRITE_SIZE_PARTS);
+}
+
 void syscall_inputs_init()
 {
-    srand(time(0));
+    mcfs_prng_init();
     inputs_t_p = (inputs_t *)malloc(sizeof(inputs_t));
     if (inputs_t_p == NULL) {
         fprintf(stderr, "Error: malloc failed for syscall_inputs_init\n");
@@ -300,70 +481,32 @@ void syscall_inputs_init()
     }
     // Init write size partition array
     populate_writesz_parts();
+    compile_input_distributions();
+    write_pool_init();
 }
 
 /*
- * Pattern: 0 - uniform, 1 - probability, 2 - inversed probability
+ * Pattern: 0 - uniform, 1 - probability, 2 - inversed probability by
+ * weighted harmonic mean, 3 - inversed probability by subtraction,
+ * 4 - rank-size distribution, 5 - inverse rank-size distribution
  * Ops: 0 - create, 1 - write
  */
 int pick_open_flags(int pattern, int ops)
 {
-    // srand(time(0)) already called at syscall_inputs_init()
+    // The PRNG is already seeded by syscall_inputs_init()
     int flags = 0;
-    // Uniform 
-    if (pattern == 0) {
-        for (int i = 0; i < MAX_FLAG_BITS; i++) {
-            // [0, 1) (i.e., up to but not including 1)
-            if ((double)rand() / (RAND_MAX) < UNIFORM_FLAG_RATE) {
-                flags |= 1 << i;
-            }
-        }
-    }
-    // Probability
-    else if (pattern == 1) {
-        for (int i = 0; i < sizeof(flagBitPercent)/sizeof(flagBitPercent[0]); i++) {
-            if ((double)rand() / (RAND_MAX) * 100 < flagBitPercent[i] * PROB_FACTOR) {
-                flags |= 1 << i;
-            }
-        }
-    }
-    // Inversed probability by weighted harmonic mean (reciprocal then normalize to 100%)
-    else if (pattern == 2) {
-        for (int i = 0; i < sizeof(whmFlagPercent)/sizeof(whmFlagPercent[0]); i++) {
-            if ((double)rand() / (RAND_MAX) * 100 < whmFlagPercent[i] * PROB_FACTOR) {
-                flags |= 1 << i;
-            }
-        }
-    }
-    // Inversed probability by substraction from 100% then normalize to 100%
-    else if (pattern == 3) {
-        for (int i = 0; i < sizeof(subFlagPercent)/sizeof(subFlagPercent[0]); i++) {
-            if ((double)rand() / (RAND_MAX) * 100 < subFlagPercent[i] * PROB_FACTOR) {
-                flags |= 1 << i;
-            }
-        }        
-    }
-    // RZD: Rank-size distribution or sampling
-    else if (pattern == 4) {
-        for (int i = 0; i < sizeof(rzdFlagPercent)/sizeof(rzdFlagPercent[0]); i++) {
-            if ((double)rand() / (RAND_MAX) < rzdFlagPercent[i]) {
-                flags |= 1 << i;
-            }
-        }
-    }
-    // Inverse Rank-size distribution or sampling
-    else if (pattern == 5) {
-        for (int i = 0; i < sizeof(inv_rzdFlagPercent)/sizeof(inv_rzdFlagPercent[0]); i++) {
-            if ((double)rand() / (RAND_MAX) < inv_rzdFlagPercent[i]) {
-                flags |= 1 << i;
-            }
-        }
-    }
-    // Not recognized
-    else {
+
+    if (pattern < 0 || pattern >= OPEN_FLAG_PATTERNS) {
         fprintf(stderr, "Error: invalid open flags pattern\n");
         exit(1);
     }
+    // One draw per flag bit that can be set in this pattern
+    for (uint32_t bits = flag_candidates[pattern]; bits; bits &= bits - 1) {
+        int i = __builtin_ctz(bits);
+        if (prng_draw() < flag_thresh[pattern][i]) {
+            flags |= 1 << i;
+        }
+    }
     if (ops == USE_CREATE_FLAG) {
         inputs_t_p->create_open_flag = flags;
     }
@@ -377,44 +520,19 @@ int pick_open_flags(int pattern, int ops)
     return flags;
 }
 
+/*
+ * Pattern: 0 - uniform distribution, 1 - Rank Size Distribution, then
+ * Normalize (RZDN), 2 - Inverse RZDN
+ */
 size_t pick_write_sizes(int pattern)
 {
     size_t writesz = 0;
-    // Uniform
-    if (pattern == 0) {
-        // Pick a partition with an uniform probability
-        int uni_idx = (int)(rand() / ((double)RAND_MAX + 1) * WRITE_SIZE_PARTS);
-        // Randomly pick a write size in a partition [minsz, maxsz]
-        writesz = rand_size(writesz_parts[uni_idx].minsz, writesz_parts[uni_idx].maxsz);
-    }
-    // Rank Size Distribution, then Normalize (RZDN)
-    else if (pattern == 1) {
-        double sum = 0;
-        // Pick a write size partition based on rzdWriteSizePrecent
-        double randNum = (float)rand() / RAND_MAX;
-        for (int i = 0; i < WRITE_SIZE_PARTS; i++) {
-            sum += rzdWriteSizePrecent[i];
-            if (randNum <= sum) {
-                // Randomly pick a write size in a partition [minsz, maxsz]
-                writesz = rand_size(writesz_parts[i].minsz, writesz_parts[i].maxsz);
-                break;
-            }
-        }
 
-    }
-    // Inverse Rank Size Distribution, then Normalize (IRZDN)
-    else if (pattern == 2) {
-        double sum = 0;
-        // Pick a write size partition based on inv_rzdWriteSizePrecent
-        double randNum = (float)rand() / RAND_MAX;
-        for (int i = 0; i < WRITE_SIZE_PARTS; i++) {
-            sum += inv_rzdWriteSizePrecent[i];
-            if (randNum <= sum) {
-                // Randomly pick a write size in a partition [minsz, maxsz]
-                writesz = rand_size(writesz_parts[i].minsz, writesz_parts[i].maxsz);
-                break;
-            }
-        }
+    if (pattern >= 0 && pattern < WRITE_SIZE_PATTERNS) {
+        // Pick a partition from the alias table of the pattern
+        int idx = sample_alias_table(&writesz_alias[pattern]);
+        // Randomly pick a write size in a partition [minsz, maxsz]
+        writesz = rand_size(writesz_parts[idx].minsz, writesz_parts[idx].maxsz);
     }
     inputs_t_p->write_size = writesz;
     return writesz;
@@ -22,76 +22,96 @@
 #include "path_utils.h"
 
 #include <assert.h>
-#include <vector>
 #include "slice.h"
 
 #define TC_PATH_MAX 4096
 
 using util::Slice;
 
-static std::vector<Slice> tc_get_path_components(Slice path)
+static inline bool is_dotdot(slice_t comp)
 {
-	std::vector<Slice> components;
-	if (path.empty()) return components;
-	bool is_absolute = path[0] == '/';
-	const char *start = path.data();
-	path.trim('/');
-	size_t beg = 0;
-	size_t end = 0;   // component within [beg, end)
-	while (end < path.size()) {
-		while (end < path.size() && path[end] != '/') {
-			++end;
-		}
-		Slice comp(path.data() + beg, end - beg);
-		if (comp == "..") {
-			if (components.empty()) {
-				if (!is_absolute)
-					components.push_back(comp);
-			} else {
-				if (components.back() != "..")
-					components.pop_back();
-				else
-					components.push_back(comp);
-			}
-		} else if (!comp.empty() && comp != "/" && comp != ".") {
-			// ignore '/', and "."
-			components.push_back(comp);
+	return comp.size == 2 && comp.data[0] == '.' && comp.data[1] == '.';
+}
+
+/*
+ * Split "path" into its normalized components, written to the caller's
+ * "components" array of "max" entries.  The leading '/' of an absolute
+ * path is kept in its first component ("/" alone for the root).
+ *
+ * Returns the number of components, or -1 if there are more than "max".
+ */
+static int tc_get_path_components(slice_t path, slice_t *components, int max)
+{
+	int n = 0;
+	if (path.size == 0) return 0;
+	bool is_absolute = path.data[0] == '/';
+	const char *start = path.data;
+	const char *p = path.data;
+	const char *end = path.data + path.size;
+	while (p < end) {
+		while (p < end && *p == '/') ++p;
+		const char *beg = p;
+		while (p < end && *p != '/') ++p;
+		slice_t comp = mkslice(beg, p - beg);
+		if (comp.size == 0 || (comp.size == 1 && comp.data[0] == '.'))
+			continue;
+		if (is_dotdot(comp) && n > 0 && !is_dotdot(components[n - 1])) {
+			--n;
+			continue;
 		}
-		beg = ++end;
+		if (is_dotdot(comp) && n == 0 && is_absolute)
+			continue;
+		if (n >= max) return -1;
+		components[n++] = comp;
 	}
 	if (is_absolute) {
-		if (!components.empty()) {
-			components[0] = Slice(components[0].data() - 1,
-					      components[0].size() + 1);
-			assert(*components[0].data() == '/');
+		if (n > 0) {
+			components[0].data -= 1;
+			components[0].size += 1;
+			assert(*components[0].data == '/');
 		} else {
-			components.push_back(Slice(start, 1));
+			if (max < 1) return -1;
+			components[n++] = mkslice(start, 1);
 		}
 	}
 
-	return components;
+	return n;
+}
+
+int tc_path_tokenize_into_s(slice_t path, slice_t *components,
+			    int max_components)
+{
+	return tc_get_path_components(path, components, max_components);
+}
+
+int tc_path_tokenize_into(const char *path, slice_t *components,
+			  int max_components)
+{
+	size_t n;
+	if (path == NULL || (n = strnlen(path, TC_PATH_MAX)) >= TC_PATH_MAX)
+		return -1;
+	return tc_get_path_components(mkslice(path, n), components,
+				      max_components);
 }
 
 int tc_path_tokenize_s(slice_t path, slice_t **components)
 {
-	std::vector<Slice> comps = tc_get_path_components(path);
-	if (components == NULL) {
-		return comps.size();
+	slice_t comps[TC_PATH_MAX_COMPONENTS];
+	int n = tc_get_path_components(path, comps, TC_PATH_MAX_COMPONENTS);
+	if (n < 0 || components == NULL) {
+		return n;
 	}
-	if (comps.empty()) {
+	if (n == 0) {
 		*components = NULL;
 		return 0;
 	}
-	slice_t *sls = (slice_t *)malloc(sizeof(slice_t) * comps.size());
+	slice_t *sls = (slice_t *)malloc(sizeof(slice_t) * n);
 	if (!sls) {
 		return -1;
 	}
-	for (size_t i = 0; i < comps.size(); ++i) {
-		sls[i].data = comps[i].data();
-		sls[i].size = comps[i].size();
-	}
+	memcpy(sls, comps, sizeof(slice_t) * n);
 	*components = sls;
-	return comps.size();
+	return n;
 }
 
 int tc_path_tokenize(const char *path, slice_t **components)
@@ -104,14 +124,12 @@ int tc_path_tokenize(const char *path, slice_t **components)
 
 int tc_path_depth_s(slice_t path)
 {
-	std::vector<Slice> comps = tc_get_path_components(path);
-	int depth;
-	if (comps.size() == 1 && comps[0] == "/") {
-		depth = 0;
-	} else {
-		depth = comps.size();
+	slice_t comps[TC_PATH_MAX_COMPONENTS];
+	int n = tc_get_path_components(path, comps, TC_PATH_MAX_COMPONENTS);
+	if (n == 1 && comps[0].size == 1 && comps[0].data[0] == '/') {
+		return 0;
 	}
-	return depth;
+	return n;
 }
 
 int tc_path_depth(const char *path)
@@ -121,24 +139,31 @@ int tc_path_depth(const char *path)
 
 int tc_path_distance_s(slice_t src, slice_t dst)
 {
+	slice_t src_comps[TC_PATH_MAX_COMPONENTS];
+	slice_t dst_comps[TC_PATH_MAX_COMPONENTS];
 	assert(dst.size > 0);
-	if (dst.data[0] != '/') {
-		auto comps = tc_get_path_components(dst);
-		return comps.size();
+	int dst_len = tc_get_path_components(dst, dst_comps,
+					     TC_PATH_MAX_COMPONENTS);
+	if (dst.data[0] != '/' || dst_len < 0) {
+		return dst_len;
 	}
 	assert(src.size > 0 && src.data[0] == '/');
-	std::vector<Slice> src_comps = tc_get_path_components(src);
-	std::vector<Slice> dst_comps = tc_get_path_components(dst);
-	int src_len = src_comps.size();
-	int dst_len = dst_comps.size();
-	if (src_len == 1 && src_comps[0] == "/") {
-		return (dst_len == 1 && dst_comps[0] == "/") ? 0 : dst_len;
+	int src_len = tc_get_path_components(src, src_comps,
+					     TC_PATH_MAX_COMPONENTS);
+	if (src_len < 0) {
+		return -1;
 	}
-	if (dst_len == 1 && dst_comps[0] == "/") {
+	bool src_root = src_len == 1 && Slice(src_comps[0]) == "/";
+	bool dst_root = dst_len == 1 && Slice(dst_comps[0]) == "/";
+	if (src_root) {
+		return dst_root ? 0 : dst_len;
+	}
+	if (dst_root) {
 		return src_len;
 	}
 	int l = 0;
-	while (l < src_len && l < dst_len && src_comps[l] == dst_comps[l])
+	while (l < src_len && l < dst_len &&
+	       Slice(src_comps[l]) == Slice(dst_comps[l]))
 		++l;
 	return src_len - l + dst_len - l;
 }
@@ -217,62 +242,118 @@ int tc_path_append(buf_t *pbuf, slice_t comp)
 
 int tc_path_normalize_s(slice_t path, buf_t *pbuf)
 {
-	std::vector<Slice> components = tc_get_path_components(path);
-	if (components.empty()) {
-		assert(path.data[0] != '/');
+	slice_t components[TC_PATH_MAX_COMPONENTS];
+	int n = tc_get_path_components(path, components,
+				       TC_PATH_MAX_COMPONENTS);
+	if (n < 0) {
+		return -1;
+	}
+	if (n == 0) {
+		assert(path.size == 0 || path.data[0] != '/');
 		buf_append_char(pbuf, '.');
 		return 1;
 	}
 
 	int old_size = pbuf->size;
-	for (size_t i = 0; i < components.size(); ++i) {
+	for (int i = 0; i < n; ++i) {
 		if (i > 0) buf_append_char(pbuf, '/');
-		buf_append_slice(pbuf, components[i].toslice());
+		buf_append_slice(pbuf, components[i]);
 	}
 	return pbuf->size - old_size;
 }
 
+int tc_path_normalize_inplace(char *path)
+{
+	bool is_absolute = path[0] == '/';
+	/* The components are written to [base, w) as they are read from r,
+	 * which is never behind w */
+	char *base = path + is_absolute;
+	char *w = base;
+	const char *r = path;
+	int ncomps = 0;
+	/* Leading ".." components of a relative path, which cannot be popped */
+	int ndotdot = 0;
+
+	while (*r) {
+		while (*r == '/') ++r;
+		const char *comp = r;
+		while (*r && *r != '/') ++r;
+		size_t len = r - comp;
+		if (len == 0 || (len == 1 && comp[0] == '.'))
+			continue;
+		if (len == 2 && comp[0] == '.' && comp[1] == '.') {
+			if (ncomps > ndotdot) {
+				/* Pop the last component and its separator */
+				while (w > base && w[-1] != '/') --w;
+				if (w > base) --w;
+				--ncomps;
+				continue;
+			}
+			if (is_absolute)
+				continue;
+			++ndotdot;
+		}
+		if (ncomps > 0) *w++ = '/';
+		memmove(w, comp, len);
+		w += len;
+		++ncomps;
+	}
+	if (ncomps == 0 && !is_absolute) *w++ = '.';
+	*w = '\0';
+	return w - path;
+}
+
 int tc_path_normalize(const char *path, char *buf, size_t buf_size)
 {
-	int plen;
+	size_t plen;
 	if (!path || (plen = strnlen(path, TC_PATH_MAX)) >= TC_PATH_MAX ||
 	    buf_size <= 1)
 		return -1;
 
-	buf_t bf = BUF_INITIALIZER(buf, buf_size);
-	int n = tc_path_normalize_s(mkslice(path, plen), &bf);
-	buf_append_null(&bf);
-	return n;
+	if (buf != path) {
+		/* The result is never longer than the path, except "" -> "." */
+		if (plen >= buf_size)
+			return -1;
+		memcpy(buf, path, plen + 1);
+	}
+	return tc_path_normalize_inplace(buf);
 }
 
 int tc_path_rebase_s(slice_t base, slice_t path, buf_t *pbuf)
 {
-	std::vector<Slice> base_comps = tc_get_path_components(base);
-	std::vector<Slice> path_comps = tc_get_path_components(path);
-	size_t l = 0;
-	while (l < base_comps.size() && l < path_comps.size() &&
-	       base_comps[l] == path_comps[l])
+	slice_t base_comps[TC_PATH_MAX_COMPONENTS];
+	slice_t path_comps[TC_PATH_MAX_COMPONENTS];
+	int nbase = tc_get_path_components(base, base_comps,
+					   TC_PATH_MAX_COMPONENTS);
+	int npath = tc_get_path_components(path, path_comps,
+					   TC_PATH_MAX_COMPONENTS);
+	if (nbase < 0 || npath < 0) {
+		return -1;
+	}
+	int l = 0;
+	while (l < nbase && l < npath &&
+	       Slice(base_comps[l]) == Slice(path_comps[l]))
 		++l;
 
-	std::vector<Slice> relative_comps;
 	size_t result_size = 0;
-	for (size_t i = l; i < base_comps.size(); ++i) {
-		relative_comps.push_back("..");
-		result_size += 2;
-	}
-	for (size_t j = l; j < path_comps.size(); ++j) {
-		relative_comps.push_back(path_comps[j]);
-		result_size += path_comps[j].size();
+	int nrelative = (nbase - l) + (npath - l);
+	result_size += (nbase - l) * 2;
+	for (int j = l; j < npath; ++j) {
+		result_size += path_comps[j].size;
 	}
-	result_size += relative_comps.size() - 1;  // count "/"s
+	if (nrelative > 0)
+		result_size += nrelative - 1;  // count "/"s
 	if (result_size > buf_remaining(pbuf)) {
 		return -1;  // buffer too small
 	}
 
 	size_t size = 0;
-	for (size_t i = 0; i < relative_comps.size(); ++i) {
+	for (int i = 0; i < nrelative; ++i) {
 		if (i > 0) size += buf_append_char(pbuf, '/');
-		size += buf_append_slice(pbuf, relative_comps[i].toslice());
+		if (i < nbase - l)
+			size += buf_append_slice(pbuf, mkslice("..", 2));
+		else
+			size += buf_append_slice(pbuf, path_comps[l + i - (nbase - l)]);
 	}
 	if (size == 0) {  // empty
 		size += buf_append_char(pbuf, '.');
@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2020-2024 Yifei Liu
+ * Copyright (c) 2020-2024 Wei Su
+ * Copyright (c) 2020-2024 Erez Zadok
+ * Copyright (c) 2020-2024 Stony Brook University
+ * Copyright (c) 2020-2024 The Research Foundation of SUNY
+ *
+ * You can redistribute it and/or modify it under the terms of the Apache
+ * License, Version 2.0 (http://www.apache.org/licenses/LICENSE-2.0).
+ */
+
+#include "prng.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+prng_state_t mcfs_prng;
+static uint64_t mcfs_seed;
+static bool mcfs_seeded = false;
+
+/* splitmix64, to spread a 64-bit seed over the 256-bit state */
+static uint64_t splitmix64(uint64_t *x)
+{
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+void mcfs_prng_seed(uint64_t seed)
+{
+    uint64_t x = seed;
+    for (int i = 0; i < 4; ++i) {
+        mcfs_prng.s[i] = splitmix64(&x);
+    }
+    mcfs_seed = seed;
+    mcfs_seeded = true;
+}
+
+static uint64_t fresh_seed(void)
+{
+    uint64_t seed;
+    int randfd = open("/dev/urandom", O_RDONLY);
+    if (randfd >= 0) {
+        ssize_t n = read(randfd, &seed, sizeof(seed));
+        close(randfd);
+        if (n == sizeof(seed))
+            return seed;
+    }
+    /* Fall back to a fine-grained timestamp so VTs still differ */
+    fprintf(stderr, "Cannot read /dev/urandom, seeding PRNG with time\n");
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec + getpid();
+}
+
+uint64_t mcfs_prng_init(void)
+{
+    if (mcfs_seeded)
+        return mcfs_seed;
+    const char *env = getenv(MCFS_SEED_ENV);
+    uint64_t seed = env ? strtoull(env, NULL, 0) : fresh_seed();
+    mcfs_prng_seed(seed);
+    return seed;
+}
+
+uint64_t mcfs_prng_get_seed(void)
+{
+    return mcfs_seed;
+}
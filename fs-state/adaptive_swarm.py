@@ -0,0 +1,274 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+
+#
+# Copyright (c) 2020-2024 Yifei Liu
+# Copyright (c) 2020-2024 Wei Su
+# Copyright (c) 2020-2024 Erez Zadok
+# Copyright (c) 2020-2024 Stony Brook University
+# Copyright (c) 2020-2024 The Research Foundation of SUNY
+#
+# You can redistribute it and/or modify it under the terms of the Apache License,
+# Version 2.0 (http://www.apache.org/licenses/LICENSE-2.0).
+#
+
+"""
+Adaptive swarm scheduler.
+
+Instead of running every swarm configuration (pan1, pan2, ... compiled from
+the options of swarm.lib) for the whole time budget, keep NUM_VTS slots busy
+and watch the new-states-per-minute of each running VT in its perf CSV.
+A VT whose rate over the last window dropped below a fraction of its own
+average rate has plateaued: it is stopped, and its slot (i.e., its swarm id,
+CPU and ramdisks) is given to a fresh VT with a new MCFS_SEED.  The
+configuration of the fresh VT is the one with the best rate so far, after
+every configuration has been tried once.
+
+Run it in fs-state after setup_swarm.sh (or the generated
+mcfs-main.pml.swarm) has compiled the pan executables, instead of running
+them through swarm:
+
+    ./adaptive_swarm.py -f ext4:256:ext2:256 -n 6 -t 4 -- -m100000 -w26
+
+Every launch and stop is logged in adaptive-swarm.csv.  The n-th VT of swarm
+id s writes its perf CSV to perf-adaptive-s<s>-<n>.csv and its stdout and
+stderr to adaptive-s<s>-<n>.log, besides its own output-*.log, so the unique
+states of the whole run can be computed with
+scripts/multi_machines_analysis/merge_timelines.
+
+A VT that exits with a non-zero status, or a new *.trail file, means that a
+discrepancy was found: the scheduler then stops all the VTs and exits
+instead of launching new ones.
+"""
+
+import argparse
+import glob
+import os
+import random
+import re
+import signal
+import subprocess
+import sys
+import time
+
+NSTATES_COL = 'nstates'
+EPOCH_COL = 'epoch'
+# Read by perf.c, see PERF_CSV_ENV in config.h
+PERF_CSV_ENV = 'MCFS_PERF_CSV'
+
+
+class Slot:
+    """One swarm id, i.e., one CPU and one set of ramdisks"""
+
+    def __init__(self, swarm_id):
+        self.swarm_id = swarm_id
+        self.proc = None
+        self.pan = None
+        self.seed = None
+        self.start = 0.0
+        # Number of VTs launched in this slot
+        self.runs = 0
+        self.perf_csv = None
+        self.output = None
+        # (epoch, nstates) samples of the running VT
+        self.samples = []
+
+
+def read_progress(perf_csv):
+    """Last (epoch, nstates) of the perf CSV of a VT"""
+    if not os.path.exists(perf_csv):
+        return None
+    with open(perf_csv, 'r') as fp:
+        header = fp.readline().strip().split(',')
+        last = None
+        for line in fp:
+            if line.strip():
+                last = line
+    if last is None:
+        return None
+    fields = last.strip().split(',')
+    try:
+        return (float(fields[header.index(EPOCH_COL)]),
+                int(fields[header.index(NSTATES_COL)]))
+    except (ValueError, IndexError):
+        return None
+
+
+def rate_over(samples, window):
+    """New states per minute over the last window seconds of samples"""
+    if len(samples) < 2:
+        return None
+    end_t, end_n = samples[-1]
+    begin = [s for s in samples if s[0] <= end_t - window]
+    if not begin:
+        return None
+    begin_t, begin_n = begin[-1]
+    return (end_n - begin_n) * 60.0 / (end_t - begin_t)
+
+
+def new_trails(since):
+    """Counterexample trails written by SPIN since the given time"""
+    return [t for t in glob.glob('*.trail') if os.path.getmtime(t) >= since]
+
+
+def average_rate(samples):
+    if len(samples) < 2 or samples[-1][0] <= 0:
+        return None
+    return samples[-1][1] * 60.0 / samples[-1][0]
+
+
+class Scheduler:
+
+    def __init__(self, args):
+        self.args = args
+        self.pans = args.pans or sorted(glob.glob('./pan[0-9]*'),
+                key=lambda p: int(re.sub(r'\D', '', p) or 0))
+        self.pans = [p for p in self.pans if os.access(p, os.X_OK)]
+        if not self.pans:
+            sys.exit('No compiled pan executables found')
+        self.slots = [Slot(i) for i in range(1, args.numvts + 1)]
+        # pan -> [total states, total minutes] of its finished runs
+        self.history = {p: [0, 0.0] for p in self.pans}
+        self.log = open(args.log, 'a')
+        if self.log.tell() == 0:
+            self.log.write('time_secs,swarm_id,event,pan,seed,pid,'
+                           'nstates,rate_per_min\n')
+        self.begin = time.time()
+
+    def record(self, slot, event, nstates='', rate=''):
+        self.log.write('%.0f,%d,%s,%s,%s,%s,%s,%s\n' % (
+            time.time() - self.begin, slot.swarm_id, event, slot.pan,
+            slot.seed, slot.proc.pid if slot.proc else '', nstates, rate))
+        self.log.flush()
+
+    def pick_pan(self):
+        untried = [p for p in self.pans if self.history[p][1] == 0 and
+                   not any(s.pan == p for s in self.slots if s.proc)]
+        if untried:
+            return untried[0]
+        return max(self.pans, key=lambda p: self.history[p][0] /
+                   max(self.history[p][1], 1e-9))
+
+    def launch(self, slot):
+        slot.pan = self.pick_pan()
+        slot.seed = random.getrandbits(63)
+        slot.runs += 1
+        name = 'adaptive-s%d-%d' % (slot.swarm_id, slot.runs)
+        # An explicit name, as a stale perf-*-<pid>.csv can match a reused pid
+        slot.perf_csv = 'perf-%s.csv' % name
+        env = dict(os.environ, MCFS_SEED=str(slot.seed))
+        env[PERF_CSV_ENV] = slot.perf_csv
+        cmd = [slot.pan, '-K', '%d:%s' % (slot.swarm_id, self.args.fslist)]
+        cmd += self.args.pan_args
+        slot.output = open('%s.log' % name, 'w')
+        slot.proc = subprocess.Popen(cmd, env=env, stdout=slot.output,
+                                     stderr=subprocess.STDOUT)
+        slot.start = time.time()
+        slot.samples = []
+        self.record(slot, 'start')
+
+    def stop(self, slot, event):
+        nstates = slot.samples[-1][1] if slot.samples else 0
+        minutes = (time.time() - slot.start) / 60.0
+        self.history[slot.pan][0] += nstates
+        self.history[slot.pan][1] += minutes
+        if slot.proc.poll() is None:
+            # SIGINT lets SPIN and the MCFS destructors clean up
+            slot.proc.send_signal(signal.SIGINT)
+            try:
+                slot.proc.wait(timeout=60)
+            except subprocess.TimeoutExpired:
+                slot.proc.kill()
+                slot.proc.wait()
+        self.record(slot, event, nstates,
+                    '%.2f' % (nstates / minutes) if minutes > 0 else '')
+        for mp in glob.glob('/mnt/test-*-s%d' % slot.swarm_id):
+            subprocess.call(['umount', '-f', mp], stderr=subprocess.DEVNULL)
+        slot.output.close()
+        slot.proc = None
+
+    def plateaued(self, slot):
+        if time.time() - slot.start < self.args.warmup * 60:
+            return False
+        recent = rate_over(slot.samples, self.args.window * 60)
+        overall = average_rate(slot.samples)
+        if recent is None or overall is None:
+            return False
+        return recent < self.args.plateau * overall
+
+    def discrepancy(self):
+        """Stop the VTs that found a discrepancy; True if any did"""
+        found = False
+        for slot in self.slots:
+            if slot.proc and slot.proc.poll() not in (None, 0):
+                sys.stderr.write('%s (swarm id %d, seed %s) exited with %d, '
+                                 'see %s\n' % (slot.pan, slot.swarm_id,
+                                 slot.seed, slot.proc.returncode,
+                                 slot.output.name))
+                self.stop(slot, 'failed')
+                found = True
+        for trail in new_trails(self.begin):
+            sys.stderr.write('Found the trail %s\n' % trail)
+            found = True
+        return found
+
+    def run(self):
+        """Schedule the VTs; False if a discrepancy was found"""
+        for slot in self.slots:
+            self.launch(slot)
+        deadline = self.begin + self.args.hours * 3600
+        found = False
+        try:
+            while time.time() < deadline:
+                time.sleep(self.args.interval)
+                for slot in self.slots:
+                    if slot.proc.poll() is not None:
+                        if slot.proc.returncode != 0:
+                            break
+                        self.stop(slot, 'exited')
+                    else:
+                        progress = read_progress(slot.perf_csv)
+                        if progress:
+                            slot.samples.append(progress)
+                        if not self.plateaued(slot):
+                            continue
+                        self.stop(slot, 'plateau')
+                    # Relaunch unless some VT found a discrepancy
+                    if new_trails(self.begin):
+                        break
+                    self.launch(slot)
+                found = self.discrepancy()
+                if found:
+                    break
+        finally:
+            for slot in self.slots:
+                if slot.proc:
+                    self.stop(slot, 'stopped' if found else 'deadline')
+            self.log.close()
+        return not found
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(
+            description='Run swarm VTs and restart the ones that plateau')
+    parser.add_argument('-f', '--fslist', required=True,
+                        help='file systems and sizes, e.g. ext4:256:ext2:256')
+    parser.add_argument('-n', '--numvts', type=int, required=True,
+                        help='number of VTs running at the same time')
+    parser.add_argument('-t', '--hours', type=float, required=True,
+                        help='time budget in hours')
+    parser.add_argument('-p', '--pans', nargs='*',
+                        help='pan executables to choose from (default ./pan[0-9]*)')
+    parser.add_argument('-w', '--window', type=float, default=10,
+                        help='minutes over which the recent rate is measured')
+    parser.add_argument('-u', '--warmup', type=float, default=20,
+                        help='minutes a VT runs before it can be stopped')
+    parser.add_argument('-r', '--plateau', type=float, default=0.1,
+                        help='a VT has plateaued when its recent rate is '
+                             'below this fraction of its average rate')
+    parser.add_argument('-i', '--interval', type=float, default=30,
+                        help='seconds between two checks')
+    parser.add_argument('-l', '--log', default='adaptive-swarm.csv',
+                        help='CSV of the scheduling events')
+    parser.add_argument('pan_args', nargs='*',
+                        help='run-time options passed to every pan (after --)')
+    sys.exit(0 if Scheduler(parser.parse_args()).run() else 1)
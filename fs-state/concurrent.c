@@ -0,0 +1,354 @@
+/*
+ * Copyright (c) 2020-2024 Yifei Liu
+ * Copyright (c) 2020-2024 Wei Su
+ * Copyright (c) 2020-2024 Erez Zadok
+ * Copyright (c) 2020-2024 Stony Brook University
+ * Copyright (c) 2020-2024 The Research Foundation of SUNY
+ *
+ * You can redistribute it and/or modify it under the terms of the Apache
+ * License, Version 2.0 (http://www.apache.org/licenses/LICENSE-2.0).
+ */
+
+#include "fileutil.h"
+#include "concurrent.h"
+#include "parameters.h"
+#include <pthread.h>
+
+int conc_threads = 0;
+int conc_ops = CONC_DEFAULT_OPS;
+
+struct conc_op {
+    enum batch_op op;
+    int fidx;
+    int didx;
+    /* Parameters of the operation, as in the batch transition */
+    int flag;
+    int mode;
+    int byte;
+    off_t offset;
+    off_t len;
+};
+
+/* Pool entries owned by a thread */
+struct conc_share {
+    int files[MAX_DIR_NUM];
+    int nfiles;
+    int dirs[MAX_DIR_NUM];
+    int ndirs;
+};
+
+/* What a thread did, for the per-thread event log */
+struct conc_event {
+    struct timespec begin;
+    struct timespec end;
+    int ret;
+    int err;
+};
+
+static const char *conc_op_names[BATCH_NR_OPS] = {
+    "create_file", "write_file_byte", "truncate", "unlink", "mkdir", "rmdir",
+    "chmod"
+};
+
+static const enum batch_op conc_file_ops[] = {
+    BATCH_CREATE, BATCH_WRITE, BATCH_TRUNCATE, BATCH_UNLINK, BATCH_CHMOD
+};
+
+static pthread_t conc_workers[CONC_MAX_THREADS];
+static int conc_ids[CONC_MAX_THREADS];
+static pthread_barrier_t round_start, round_end;
+static bool conc_stop;
+/* The plan of the current transition and where the workers are in it */
+static struct conc_op plan[CONC_MAX_THREADS][CONC_MAX_OPS];
+static struct conc_share shares[CONC_MAX_THREADS];
+static int cur_fs, cur_round;
+static struct conc_event events[MAX_FS][CONC_MAX_THREADS][CONC_MAX_OPS];
+
+static const char *conc_file(int fs, const struct conc_op *o)
+{
+    return enable_fdpool ? get_filepool()[fs][o->fidx] : get_testfiles()[fs];
+}
+
+static const char *conc_dir(int fs, const struct conc_op *o)
+{
+    return enable_fdpool ? get_directorypool()[fs][o->didx] : get_testdirs()[fs];
+}
+
+static int conc_do_op(int fs, const struct conc_op *o)
+{
+    const char *file = conc_file(fs, o);
+    const char *dir = conc_dir(fs, o);
+
+    switch (o->op) {
+    case BATCH_CREATE:
+        return create_file(file, o->flag, o->mode);
+    case BATCH_WRITE:
+        return write_file_byte(file, o->flag, o->byte, o->offset, o->len);
+    case BATCH_TRUNCATE:
+        return truncate(file, o->len);
+    case BATCH_UNLINK:
+        return unlink(file);
+    case BATCH_MKDIR:
+        return mkdir(dir, 0755);
+    case BATCH_RMDIR:
+        return rmdir(dir);
+    case BATCH_CHMOD:
+        return chmod(file, o->mode);
+    default:
+        errno = EINVAL;
+        return -1;
+    }
+}
+
+/* Same format as makecall(), so that the replayers can run the plan */
+static void conc_record_op(int fs, const struct conc_op *o)
+{
+    const char *func = conc_op_names[o->op];
+    const char *file = conc_file(fs, o);
+    const char *dir = conc_dir(fs, o);
+
+    switch (o->op) {
+    case BATCH_CREATE:
+        record_seq("%s, %s, %d, 0%o\n", func, file, o->flag, o->mode);
+        break;
+    case BATCH_WRITE:
+        record_seq("%s, %s, %d, %d, %ld, %zu\n", func, file, o->flag,
+                   o->byte, o->offset, (size_t)o->len);
+        break;
+    case BATCH_TRUNCATE:
+        record_seq("%s, %s, %ld\n", func, file, o->len);
+        break;
+    case BATCH_UNLINK:
+        record_seq("%s, %s\n", func, file);
+        break;
+    case BATCH_MKDIR:
+        record_seq("%s, %s, 0%o\n", func, dir, 0755);
+        break;
+    case BATCH_RMDIR:
+        record_seq("%s, %s\n", func, dir);
+        break;
+    case BATCH_CHMOD:
+        record_seq("%s, %s, 0%o\n", func, file, o->mode);
+        break;
+    default:
+        break;
+    }
+}
+
+static void *conc_worker(void *arg)
+{
+    int t = *(int *)arg;
+
+    while (true) {
+        pthread_barrier_wait(&round_start);
+        if (conc_stop)
+            break;
+        struct conc_event *e = &events[cur_fs][t][cur_round];
+        current_utc_time(&e->begin);
+        errno = 0;
+        e->ret = conc_do_op(cur_fs, &plan[t][cur_round]);
+        e->err = errno;
+        current_utc_time(&e->end);
+        pthread_barrier_wait(&round_end);
+    }
+    return NULL;
+}
+
+/*
+ * The subtree of a pool path: its top-level entry, e.g. "/d-00" for
+ * "/d-00/d-01/f-02".  Returns its index in tops, adding it if it is new.
+ */
+static int conc_subtree(const char *path, const char **tops, size_t *lens,
+                        int *ntops)
+{
+    const char *rel = path + strlen(get_basepaths()[0]);
+    const char *slash = strchr(rel + 1, '/');
+    size_t len = slash ? (size_t)(slash - rel) : strlen(rel);
+
+    for (int i = 0; i < *ntops; ++i) {
+        if (lens[i] == len && strncmp(tops[i], rel, len) == 0)
+            return i;
+    }
+    tops[*ntops] = rel;
+    lens[*ntops] = len;
+    return (*ntops)++;
+}
+
+/*
+ * Deal the subtrees of the pools out to the threads, so that a directory
+ * and all the files and directories below it belong to one thread.  The
+ * top-level directories come first, so that the threads that own one are
+ * as many as possible.
+ */
+static void conc_share_pools()
+{
+    static const char *tops[2 * MAX_DIR_NUM];
+    static size_t lens[2 * MAX_DIR_NUM];
+    static int dir_tree[MAX_DIR_NUM], file_tree[MAX_DIR_NUM];
+    int ntops = 0;
+
+    for (int j = 0; j < get_dpoolsize(); ++j)
+        dir_tree[j] = conc_subtree(get_directorypool()[0][j], tops, lens,
+                                   &ntops);
+    for (int j = 0; j < get_fpoolsize(); ++j)
+        file_tree[j] = conc_subtree(get_filepool()[0][j], tops, lens,
+                                    &ntops);
+    /* Every thread owns at least one subtree, hence a file */
+    conc_threads = min(conc_threads, ntops);
+
+    memset(shares, 0, sizeof(shares));
+    for (int j = 0; j < get_dpoolsize(); ++j) {
+        struct conc_share *sh = &shares[dir_tree[j] % conc_threads];
+        sh->dirs[sh->ndirs++] = j;
+    }
+    for (int j = 0; j < get_fpoolsize(); ++j) {
+        struct conc_share *sh = &shares[file_tree[j] % conc_threads];
+        sh->files[sh->nfiles++] = j;
+    }
+}
+
+void conc_init()
+{
+    if (getenv(CONC_THREADS_ENV))
+        conc_threads = atoi(getenv(CONC_THREADS_ENV));
+    if (getenv(CONC_OPS_ENV))
+        conc_ops = atoi(getenv(CONC_OPS_ENV));
+    if (conc_threads < 2) {
+        conc_threads = 0;
+        return;
+    }
+    conc_threads = min(conc_threads, CONC_MAX_THREADS);
+    /* Every thread needs a share of its own in the pools */
+    if (!enable_fdpool) {
+        conc_threads = 0;
+        logwarn("concurrent mode needs the file and directory pools");
+        return;
+    }
+    conc_share_pools();
+    if (conc_threads < 2) {
+        conc_threads = 0;
+        logwarn("concurrent mode needs at least two subtrees in the pools");
+        return;
+    }
+    if (conc_ops < 1)
+        conc_ops = 1;
+    conc_ops = min(conc_ops, CONC_MAX_OPS);
+
+    pthread_barrier_init(&round_start, NULL, conc_threads + 1);
+    pthread_barrier_init(&round_end, NULL, conc_threads + 1);
+    for (int t = 0; t < conc_threads; ++t) {
+        conc_ids[t] = t;
+        int ret = pthread_create(&conc_workers[t], NULL, conc_worker,
+                                 &conc_ids[t]);
+        assert(ret == 0);
+    }
+}
+
+void conc_destroy()
+{
+    if (conc_threads < 2)
+        return;
+    conc_stop = true;
+    pthread_barrier_wait(&round_start);
+    for (int t = 0; t < conc_threads; ++t) {
+        pthread_join(conc_workers[t], NULL);
+    }
+    pthread_barrier_destroy(&round_start);
+    pthread_barrier_destroy(&round_end);
+    conc_threads = 0;
+}
+
+/* Draw an operation of thread t on its own share of the pools */
+static void conc_plan_op(int t, struct conc_op *o)
+{
+    const struct conc_share *sh = &shares[t];
+
+    memset(o, 0, sizeof(*o));
+    /* A thread that owns no directory only works on files */
+    if (sh->ndirs > 0)
+        o->op = mcfs_prng_below(BATCH_NR_OPS);
+    else
+        o->op = conc_file_ops[mcfs_prng_below(sizeof(conc_file_ops) /
+                                              sizeof(conc_file_ops[0]))];
+    o->fidx = sh->files[mcfs_prng_below(sh->nfiles)];
+    o->didx = sh->ndirs > 0 ? sh->dirs[mcfs_prng_below(sh->ndirs)] : 0;
+
+    switch (o->op) {
+    case BATCH_CREATE:
+        o->flag = param_create_open_flag();
+        o->mode = param_create_open_mode();
+        break;
+    case BATCH_WRITE:
+        o->flag = param_write_open_flag();
+        o->offset = param_write_offset();
+        o->len = param_write_size();
+        o->byte = param_write_byte();
+        break;
+    case BATCH_TRUNCATE:
+        o->len = param_truncate_len();
+        break;
+    case BATCH_CHMOD:
+        o->mode = param_chmod_mode();
+        break;
+    default:
+        break;
+    }
+}
+
+static void conc_log_events(int fs)
+{
+    for (int k = 0; k < conc_ops; ++k) {
+        for (int t = 0; t < conc_threads; ++t) {
+            struct conc_event *e = &events[fs][t][k];
+            struct timespec begin, end;
+            timediff(&begin, &e->begin, &begin_time);
+            timediff(&end, &e->end, &begin_time);
+            makelog("[conc %s t=%d r=%d] %ld.%09ld-%ld.%09ld %s -> "
+                    "ret = %d, err = %s\n", get_fslist()[fs], t, k,
+                    begin.tv_sec, begin.tv_nsec, end.tv_sec, end.tv_nsec,
+                    conc_op_names[plan[t][k].op], e->ret, errnoname(e->err));
+        }
+    }
+}
+
+/*
+ * Run one concurrent plan against every file system (mounted by the
+ * caller).  Returns whether all file systems agreed on the return values
+ * and errnos of every operation.
+ */
+bool run_concurrent_ops()
+{
+    bool res = true;
+    int nums[MAX_FS];
+
+    for (int t = 0; t < conc_threads; ++t) {
+        for (int k = 0; k < conc_ops; ++k)
+            conc_plan_op(t, &plan[t][k]);
+    }
+
+    for (int i = 0; i < get_n_fs(); ++i) {
+        cur_fs = i;
+        for (int k = 0; k < conc_ops; ++k) {
+            cur_round = k;
+            for (int t = 0; t < conc_threads; ++t) {
+                conc_record_op(i, &plan[t][k]);
+                count++;
+            }
+            pthread_barrier_wait(&round_start);
+            pthread_barrier_wait(&round_end);
+        }
+        conc_log_events(i);
+    }
+
+    for (int k = 0; k < conc_ops; ++k) {
+        for (int t = 0; t < conc_threads; ++t) {
+            for (int i = 0; i < get_n_fs(); ++i)
+                nums[i] = events[i][t][k].ret;
+            res &= compare_equality_values(get_fslist(), get_n_fs(), nums);
+            for (int i = 0; i < get_n_fs(); ++i)
+                nums[i] = events[i][t][k].err;
+            res &= compare_equality_values(get_fslist(), get_n_fs(), nums);
+        }
+    }
+    return res;
+}
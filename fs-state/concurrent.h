@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2020-2024 Yifei Liu
+ * Copyright (c) 2020-2024 Wei Su
+ * Copyright (c) 2020-2024 Erez Zadok
+ * Copyright (c) 2020-2024 Stony Brook University
+ * Copyright (c) 2020-2024 The Research Foundation of SUNY
+ *
+ * You can redistribute it and/or modify it under the terms of the Apache
+ * License, Version 2.0 (http://www.apache.org/licenses/LICENSE-2.0).
+ */
+
+#ifndef _CONCURRENT_H_
+#define _CONCURRENT_H_
+
+#include <stdbool.h>
+
+/*
+ * Concurrent mode: a transition in which conc_threads worker threads issue
+ * conc_ops operations each against every file system.  The operations are
+ * run in lockstep rounds: round k releases the k-th operation of all
+ * threads at once, so the file systems see the same interleaving of
+ * rounds while each round runs in parallel.  Every thread owns whole
+ * subtrees of the pools (a top-level directory with everything below it,
+ * or a file at the top level), so no operation of a thread can change the
+ * outcome of another thread's (short of running out of space), and a
+ * correct file system ends up in the same abstract state as the reference
+ * one.  The operations and their
+ * parameters are drawn from the driver's PRNG, not by SPIN.
+ */
+#define CONC_THREADS_ENV "MCFS_CONC_THREADS"
+#define CONC_OPS_ENV "MCFS_CONC_OPS"
+#define CONC_DEFAULT_OPS 4
+#define CONC_MAX_THREADS 16
+#define CONC_MAX_OPS 64
+
+extern int conc_threads;
+extern int conc_ops;
+
+void conc_init();
+void conc_destroy();
+bool run_concurrent_ops();
+
+#endif // _CONCURRENT_H_
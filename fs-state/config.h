@@ -17,6 +17,8 @@
 #define MAX_OPENED_FILES 192
 /* The file name of or the path to the performance log */
 #define PERF_PREFIX      "perf"
+/* Overrides the name of the performance log, e.g., for a scheduler */
+#define PERF_CSV_ENV     "MCFS_PERF_CSV"
 /* The name of or the path to the logs (without .log suffix) */
 #define SEQ_PREFIX       "sequence"
 #define OUTPUT_PREFIX    "output"
@@ -0,0 +1,267 @@
+/*
+ * Copyright (c) 2020-2024 Yifei Liu
+ * Copyright (c) 2020-2024 Wei Su
+ * Copyright (c) 2020-2024 Erez Zadok
+ * Copyright (c) 2020-2024 Stony Brook University
+ * Copyright (c) 2020-2024 The Research Foundation of SUNY
+ *
+ * You can redistribute it and/or modify it under the terms of the Apache
+ * License, Version 2.0 (http://www.apache.org/licenses/LICENSE-2.0).
+ */
+
+#include "fileutil.h"
+#include "dedup.h"
+#include <endian.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+bool dedup_mode = false;
+uint64_t dedup_sent = 0;
+uint64_t dedup_global_new = 0;
+uint64_t dedup_global_total = 0;
+
+static int sock = -1;
+static uint32_t my_vt;
+static int batch_size = DEDUP_DEFAULT_BATCH;
+static int stale_limit = 0;
+static int stale_batches = 0;
+static int timeout_ms = DEDUP_DEFAULT_TIMEOUT_MS;
+static unsigned char batch[DEDUP_MAX_BATCH][DEDUP_STATE_SIZE];
+static int nbatch;
+/* Reply bitmap of the last batch */
+static unsigned char new_bits[(DEDUP_MAX_BATCH + 7) / 8];
+static int nreplied;
+
+/* "unix:/path", "host:port" or "host" */
+static int connect_coordinator(const char *addr)
+{
+    if (strncmp(addr, "unix:", 5) == 0) {
+        struct sockaddr_un sun = {.sun_family = AF_UNIX};
+        if (strlen(addr + 5) >= sizeof(sun.sun_path))
+            return -ENAMETOOLONG;
+        strcpy(sun.sun_path, addr + 5);
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+            return -errno;
+        if (connect(fd, (struct sockaddr *)&sun, sizeof(sun)) != 0) {
+            int err = -errno;
+            close(fd);
+            return err;
+        }
+        return fd;
+    }
+
+    char host[NAME_MAX] = {0};
+    char port[16];
+    const char *colon = strrchr(addr, ':');
+    size_t hostlen = colon ? (size_t)(colon - addr) : strlen(addr);
+    if (hostlen >= sizeof(host))
+        return -ENAMETOOLONG;
+    memcpy(host, addr, hostlen);
+    if (colon)
+        snprintf(port, sizeof(port), "%s", colon + 1);
+    else
+        snprintf(port, sizeof(port), "%d", DEDUP_DEFAULT_PORT);
+
+    struct addrinfo hints = {.ai_family = AF_UNSPEC,
+                             .ai_socktype = SOCK_STREAM};
+    struct addrinfo *res, *ai;
+    int ret = getaddrinfo(host, port, &hints, &res);
+    if (ret != 0)
+        return -EHOSTUNREACH;
+    int fd = -ECONNREFUSED;
+    for (ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0)
+            continue;
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+            break;
+        close(fd);
+        fd = -ECONNREFUSED;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+static int send_all(const void *buf, size_t len)
+{
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = send(sock, p, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int recv_all(void *buf, size_t len)
+{
+    char *p = buf;
+    while (len > 0) {
+        ssize_t n = recv(sock, p, len, 0);
+        if (n == 0)
+            return -ECONNRESET;
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static void close_coordinator()
+{
+    if (sock >= 0)
+        close(sock);
+    sock = -1;
+    dedup_mode = false;
+}
+
+static void dedup_flush()
+{
+    struct dedup_req_hdr req = {
+        .magic = htonl(DEDUP_MAGIC),
+        .vt_id = htonl(my_vt),
+        .nstates = htonl(nbatch),
+    };
+    struct dedup_reply_hdr reply;
+    int ret;
+
+    ret = send_all(&req, sizeof(req));
+    if (ret == 0)
+        ret = send_all(batch, nbatch * DEDUP_STATE_SIZE);
+    if (ret == 0)
+        ret = recv_all(&reply, sizeof(reply));
+    if (ret == 0 && ntohl(reply.nstates) != (uint32_t)nbatch)
+        ret = -EPROTO;
+    if (ret == 0)
+        ret = recv_all(new_bits, (nbatch + 7) / 8);
+    if (ret == 0) {
+        uint32_t nset = 0;
+        for (int i = 0; i < nbatch; ++i)
+            nset += (new_bits[i / 8] >> (i % 8)) & 1;
+        if (nset != ntohl(reply.nnew))
+            ret = -EPROTO;
+    }
+    if (ret != 0) {
+        /* The run goes on with local exploration only: after a timeout the
+         * stream may be in the middle of a message, so it is not reused */
+        if (ret == -EAGAIN || ret == -EWOULDBLOCK) {
+            logwarn("The dedup coordinator did not answer within %d ms, "
+                    "disabling global dedup", timeout_ms);
+        } else {
+            logerr("Lost the dedup coordinator (%s), disabling global dedup",
+                   errnoname(-ret));
+        }
+        close_coordinator();
+        return;
+    }
+
+    uint32_t nnew = ntohl(reply.nnew);
+    dedup_sent += nbatch;
+    dedup_global_new += nnew;
+    dedup_global_total = be64toh(reply.total);
+    nreplied = nbatch;
+    nbatch = 0;
+
+    bool any_new = false;
+    for (int i = 0; i < dedup_last_batch_size() && !any_new; ++i)
+        any_new = dedup_was_new(i);
+    stale_batches = any_new ? 0 : stale_batches + 1;
+    if (stale_limit > 0 && stale_batches >= stale_limit) {
+        /* Let the swarm scheduler restart this VT with other options */
+        makelog("No globally new state in %d batches, stopping this VT\n",
+                stale_batches);
+        exit(0);
+    }
+}
+
+void dedup_init(int vt_id)
+{
+    const char *addr = getenv(DEDUP_ADDR_ENV);
+    const char *batch_str = getenv(DEDUP_BATCH_ENV);
+    const char *stale_str = getenv(DEDUP_STALE_ENV);
+    const char *timeout_str = getenv(DEDUP_TIMEOUT_ENV);
+
+    if (!addr)
+        return;
+    if (batch_str) {
+        batch_size = atoi(batch_str);
+        if (batch_size < 1 || batch_size > DEDUP_MAX_BATCH)
+            batch_size = DEDUP_DEFAULT_BATCH;
+    }
+    if (stale_str)
+        stale_limit = atoi(stale_str);
+    if (timeout_str) {
+        timeout_ms = atoi(timeout_str);
+        if (timeout_ms < 1)
+            timeout_ms = DEDUP_DEFAULT_TIMEOUT_MS;
+    }
+    my_vt = vt_id < 0 ? 0 : vt_id;
+    sock = connect_coordinator(addr);
+    if (sock < 0) {
+        logerr("Cannot connect to the dedup coordinator at %s (%s)", addr,
+               errnoname(-sock));
+        sock = -1;
+        return;
+    }
+    /* update_before_hook() must not block on a stuck coordinator */
+    struct timeval tv = {
+        .tv_sec = timeout_ms / 1000,
+        .tv_usec = (timeout_ms % 1000) * 1000,
+    };
+    if (setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) != 0 ||
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) != 0) {
+        logerr("Cannot set the dedup coordinator timeouts");
+        close_coordinator();
+        return;
+    }
+    dedup_mode = true;
+}
+
+void dedup_destroy()
+{
+    /* Report the last partial batch, without stopping in the destructor */
+    if (dedup_mode && nbatch > 0) {
+        stale_limit = 0;
+        dedup_flush();
+    }
+    close_coordinator();
+}
+
+int dedup_last_batch_size()
+{
+    return nreplied;
+}
+
+bool dedup_was_new(int i)
+{
+    if (i < 0 || i >= nreplied)
+        return false;
+    return (new_bits[i / 8] >> (i % 8)) & 1;
+}
+
+/* Queue a state that is new to this VT; the batch goes out when full.
+ * All the file systems make up the state, as in absfs_set_add(). */
+void dedup_submit(absfs_state_t *states)
+{
+    XXH128_canonical_t digest;
+
+    if (!dedup_mode)
+        return;
+    XXH128_canonicalFromHash(&digest, XXH3_128bits(states,
+                             get_n_fs() * sizeof(absfs_state_t)));
+    memcpy(batch[nbatch++], &digest, DEDUP_STATE_SIZE);
+    if (nbatch >= batch_size)
+        dedup_flush();
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2020-2024 Yifei Liu
+ * Copyright (c) 2020-2024 Wei Su
+ * Copyright (c) 2020-2024 Erez Zadok
+ * Copyright (c) 2020-2024 Stony Brook University
+ * Copyright (c) 2020-2024 The Research Foundation of SUNY
+ *
+ * You can redistribute it and/or modify it under the terms of the Apache
+ * License, Version 2.0 (http://www.apache.org/licenses/LICENSE-2.0).
+ */
+
+#ifndef _DEDUP_H_
+#define _DEDUP_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Global state deduplication across machines.  A coordinator
+ * (dedup_coordinator.cpp) keeps the set of abstract states seen by all the
+ * VTs.  Each VT sends it batches of the states that are new to the VT and
+ * gets back which of them are new globally.  A state is the 128-bit
+ * XXH3 digest of the abstract states of all the file systems.
+ *
+ * Wire protocol, all integers in network byte order:
+ *   request:  struct dedup_req_hdr, then nstates 16-byte states
+ *   reply:    struct dedup_reply_hdr, then (nstates + 7) / 8 bytes of
+ *             bitmap, where bit i (LSB first) is set if state i was new
+ */
+#define DEDUP_ADDR_ENV "MCFS_DEDUP_ADDR"
+#define DEDUP_BATCH_ENV "MCFS_DEDUP_BATCH"
+/* Stop the VT after this many batches in a row without a new state */
+#define DEDUP_STALE_ENV "MCFS_DEDUP_STALE_BATCHES"
+/* Give up on the coordinator if a send or reply takes longer (ms) */
+#define DEDUP_TIMEOUT_ENV "MCFS_DEDUP_TIMEOUT_MS"
+
+#define DEDUP_DEFAULT_PORT 9473
+#define DEDUP_DEFAULT_BATCH 64
+#define DEDUP_MAX_BATCH 4096
+#define DEDUP_DEFAULT_TIMEOUT_MS 2000
+#define DEDUP_STATE_SIZE 16
+#define DEDUP_MAGIC 0x4d434644 /* "MCFD" */
+
+struct dedup_req_hdr {
+    uint32_t magic;
+    uint32_t vt_id;
+    uint32_t nstates;
+};
+
+struct dedup_reply_hdr {
+    uint32_t nstates;
+    uint32_t nnew;
+    /* Number of unique states in the global set */
+    uint64_t total;
+};
+
+#ifndef __cplusplus
+#include "abstract_fs.h"
+
+extern bool dedup_mode;
+/* Totals reported in the perf CSV */
+extern uint64_t dedup_sent;
+extern uint64_t dedup_global_new;
+extern uint64_t dedup_global_total;
+
+void dedup_init(int vt_id);
+void dedup_destroy();
+void dedup_submit(absfs_state_t *states);
+/* The last batch answered by the coordinator: its size, and whether its
+ * i-th state (in submission order) was new to all the VTs */
+int dedup_last_batch_size();
+bool dedup_was_new(int i);
+#endif
+
+#endif // _DEDUP_H_
@@ -0,0 +1,306 @@
+/*
+ * Copyright (c) 2020-2024 Yifei Liu
+ * Copyright (c) 2020-2024 Wei Su
+ * Copyright (c) 2020-2024 Erez Zadok
+ * Copyright (c) 2020-2024 Stony Brook University
+ * Copyright (c) 2020-2024 The Research Foundation of SUNY
+ *
+ * You can redistribute it and/or modify it under the terms of the Apache
+ * License, Version 2.0 (http://www.apache.org/licenses/LICENSE-2.0).
+ */
+
+/*
+ * Coordinator of the global state deduplication (see dedup.h).
+ *
+ * Usage: dedup_coordinator [-l port | -l unix:/path] [-i report_secs]
+ *
+ * It serves any number of VTs from a single thread with poll(), keeps the
+ * global set of abstract states, and prints the live global coverage as a
+ * CSV line every report interval (default 5 seconds):
+ *   epoch,nclients,nreceived,nunique
+ * VTs are told apart by the host they connect from and their swarm id.
+ */
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cinttypes>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <endian.h>
+#include <map>
+#include <netinet/in.h>
+#include <poll.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <unordered_set>
+#include <vector>
+#include "dedup.h"
+
+struct StateKey {
+  uint64_t lo;
+  uint64_t hi;
+};
+
+static bool operator==(const StateKey &a, const StateKey &b) {
+  return a.lo == b.lo && a.hi == b.hi;
+}
+
+struct StateKeyHasher {
+  size_t operator()(StateKey const &k) const noexcept {
+    /* The states are MD5/xxHash digests already */
+    return k.lo ^ k.hi;
+  }
+};
+
+struct VtStat {
+  uint64_t received = 0;
+  uint64_t fresh = 0;
+};
+
+struct Client {
+  int fd;
+  /* Peer address, "unix" for local clients */
+  std::string host;
+  /* Bytes of the request being received */
+  std::vector<unsigned char> buf;
+};
+
+static std::unordered_set<StateKey, StateKeyHasher> global_states;
+/* Swarm ids restart from 1 on every machine */
+static std::map<std::pair<std::string, uint32_t>, VtStat> vt_stats;
+static uint64_t nreceived;
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig) {
+  stop = 1;
+}
+
+static int listen_on(const char *addr) {
+  int fd;
+  if (strncmp(addr, "unix:", 5) == 0) {
+    struct sockaddr_un sun;
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    if (strlen(addr + 5) >= sizeof(sun.sun_path)) {
+      fprintf(stderr, "Socket path too long: %s\n", addr + 5);
+      exit(1);
+    }
+    strcpy(sun.sun_path, addr + 5);
+    unlink(sun.sun_path);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&sun, sizeof(sun)) != 0) {
+      perror("bind");
+      exit(1);
+    }
+  } else {
+    struct sockaddr_in6 sin6;
+    int off = 0, on = 1;
+    memset(&sin6, 0, sizeof(sin6));
+    sin6.sin6_family = AF_INET6;
+    sin6.sin6_addr = in6addr_any;
+    sin6.sin6_port = htons(atoi(addr));
+    fd = socket(AF_INET6, SOCK_STREAM, 0);
+    if (fd < 0) {
+      perror("socket");
+      exit(1);
+    }
+    /* Accept IPv4 clients too */
+    setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (bind(fd, (struct sockaddr *)&sin6, sizeof(sin6)) != 0) {
+      perror("bind");
+      exit(1);
+    }
+  }
+  if (listen(fd, 128) != 0) {
+    perror("listen");
+    exit(1);
+  }
+  return fd;
+}
+
+static bool send_all(int fd, const void *buf, size_t len) {
+  const char *p = (const char *)buf;
+  while (len > 0) {
+    ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+/*
+ * Size of the complete request at the head of buf, 0 if unknown yet, or -1
+ * if the header is invalid.  Checked before buffering the states, so that a
+ * bogus nstates cannot make the coordinator wait for gigabytes.
+ */
+static ssize_t request_size(const std::vector<unsigned char> &buf) {
+  if (buf.size() < sizeof(dedup_req_hdr))
+    return 0;
+  const dedup_req_hdr *hdr = (const dedup_req_hdr *)buf.data();
+  uint32_t nstates = ntohl(hdr->nstates);
+  if (ntohl(hdr->magic) != DEDUP_MAGIC || nstates > DEDUP_MAX_BATCH)
+    return -1;
+  return sizeof(dedup_req_hdr) + (size_t)nstates * DEDUP_STATE_SIZE;
+}
+
+/* Answer one complete request; false if the reply cannot be sent */
+static bool serve_request(Client &c) {
+  const dedup_req_hdr *hdr = (const dedup_req_hdr *)c.buf.data();
+  uint32_t nstates = ntohl(hdr->nstates);
+  VtStat &vt = vt_stats[{c.host, ntohl(hdr->vt_id)}];
+  const unsigned char *states = c.buf.data() + sizeof(dedup_req_hdr);
+  std::vector<unsigned char> bitmap((nstates + 7) / 8, 0);
+  uint32_t nnew = 0;
+  for (uint32_t i = 0; i < nstates; ++i) {
+    StateKey k;
+    memcpy(&k, states + i * DEDUP_STATE_SIZE, DEDUP_STATE_SIZE);
+    if (global_states.insert(k).second) {
+      bitmap[i / 8] |= 1 << (i % 8);
+      nnew++;
+    }
+  }
+  vt.received += nstates;
+  vt.fresh += nnew;
+  nreceived += nstates;
+
+  dedup_reply_hdr reply;
+  reply.nstates = htonl(nstates);
+  reply.nnew = htonl(nnew);
+  reply.total = htobe64(global_states.size());
+  return send_all(c.fd, &reply, sizeof(reply)) &&
+         send_all(c.fd, bitmap.data(), bitmap.size());
+}
+
+/* Read what is available; false when the connection should be closed */
+static bool handle_input(Client &c) {
+  unsigned char chunk[64 * 1024];
+  ssize_t n = recv(c.fd, chunk, sizeof(chunk), 0);
+  if (n < 0 && errno == EINTR)
+    return true;
+  if (n <= 0)
+    return false;
+  c.buf.insert(c.buf.end(), chunk, chunk + n);
+  ssize_t size;
+  while ((size = request_size(c.buf)) != 0) {
+    if (size < 0)
+      return false;
+    if (c.buf.size() < (size_t)size)
+      break;
+    if (!serve_request(c))
+      return false;
+    c.buf.erase(c.buf.begin(), c.buf.begin() + size);
+  }
+  return true;
+}
+
+/* Name of the peer, so that VTs of different machines are kept apart */
+static std::string peer_host(int fd) {
+  struct sockaddr_storage ss;
+  socklen_t len = sizeof(ss);
+  char host[INET6_ADDRSTRLEN] = "unknown";
+  if (getpeername(fd, (struct sockaddr *)&ss, &len) != 0)
+    return host;
+  if (ss.ss_family == AF_UNIX)
+    return "unix";
+  if (ss.ss_family == AF_INET6) {
+    struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&ss;
+    inet_ntop(AF_INET6, &sin6->sin6_addr, host, sizeof(host));
+  } else if (ss.ss_family == AF_INET) {
+    struct sockaddr_in *sin = (struct sockaddr_in *)&ss;
+    inet_ntop(AF_INET, &sin->sin_addr, host, sizeof(host));
+  }
+  return host;
+}
+
+int main(int argc, char **argv) {
+  const char *addr = nullptr;
+  int interval = 5;
+  int opt;
+  char default_addr[16];
+
+  while ((opt = getopt(argc, argv, "l:i:")) != -1) {
+    switch (opt) {
+    case 'l':
+      addr = optarg;
+      break;
+    case 'i':
+      interval = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-l port | -l unix:/path] [-i report_secs]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+  if (!addr) {
+    snprintf(default_addr, sizeof(default_addr), "%d", DEDUP_DEFAULT_PORT);
+    addr = default_addr;
+  }
+  if (interval < 1)
+    interval = 1;
+
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+  int lfd = listen_on(addr);
+  std::vector<Client> clients;
+  time_t begin = time(NULL), last_report = begin;
+  printf("epoch,nclients,nreceived,nunique\n");
+  fflush(stdout);
+
+  while (!stop) {
+    std::vector<struct pollfd> pfds(clients.size() + 1);
+    pfds[0] = {lfd, POLLIN, 0};
+    for (size_t i = 0; i < clients.size(); ++i)
+      pfds[i + 1] = {clients[i].fd, POLLIN, 0};
+    int ret = poll(pfds.data(), pfds.size(), 1000);
+    if (ret < 0 && errno != EINTR) {
+      perror("poll");
+      break;
+    }
+    /* Serve existing clients first, then accept, so indices match */
+    for (size_t i = clients.size(); ret > 0 && i-- > 0;) {
+      if (!pfds[i + 1].revents)
+        continue;
+      if (!handle_input(clients[i])) {
+        close(clients[i].fd);
+        clients.erase(clients.begin() + i);
+      }
+    }
+    if (ret > 0 && (pfds[0].revents & POLLIN)) {
+      int fd = accept(lfd, NULL, NULL);
+      if (fd >= 0)
+        clients.push_back({fd, peer_host(fd), {}});
+    }
+    time_t now = time(NULL);
+    if (now - last_report >= interval) {
+      printf("%ld,%zu,%" PRIu64 ",%zu\n", (long)(now - begin), clients.size(),
+             nreceived, global_states.size());
+      fflush(stdout);
+      last_report = now;
+    }
+  }
+
+  /* Per-VT summary */
+  fprintf(stderr, "host,vt,received,globally_new\n");
+  for (auto &it : vt_stats) {
+    fprintf(stderr, "%s,%u,%" PRIu64 ",%" PRIu64 "\n",
+            it.first.first.c_str(), it.first.second, it.second.received,
+            it.second.fresh);
+  }
+  for (Client &c : clients)
+    close(c.fd);
+  close(lfd);
+  if (strncmp(addr, "unix:", 5) == 0)
+    unlink(addr + 5);
+  return 0;
+}
@@ -11,9 +11,10 @@
 
 #include "fileutil.h"
 #include "cr.h"
-#include "custom_heap.h"
+#include "brd_ioctl.h"
 #include <sys/wait.h>
 #include <sys/vfs.h>
+#include <inttypes.h>
 
 #define IS_CHECKPOINT true
 #define IS_SNAPSHOT false
@@ -42,6 +43,9 @@ bool enable_complex_ops = true;
 bool enable_complex_ops = false;
 #endif
 
+int batch_ops = 0;
+bool batch_check_each = false;
+
 #ifdef FILEDIR_POOL
 #define FILEDIR_EXIST_PROB 0.5
 #endif
@@ -50,12 +54,77 @@ bool enable_complex_ops = false;
 circular_buf_sum_t *fsimg_bufs;
 #endif
 
+/*
+ * Offset of the first byte that differs between buf1 and buf2 (len bytes),
+ * or -1 if they are equal.  memcmp() runs on whole blocks, which glibc
+ * vectorizes; only the block that differs is scanned byte by byte.
+ */
+static ssize_t first_diff(const char *buf1, const char *buf2, size_t len)
+{
+    const size_t step = 4096;
+    for (size_t off = 0; off < len; off += step) {
+        size_t n = min(step, len - off);
+        if (memcmp(buf1 + off, buf2 + off, n) == 0)
+            continue;
+        while (buf1[off] == buf2[off])
+            off++;
+        return off;
+    }
+    return -1;
+}
+
+static int read_full(int fd, char *buf, size_t len, off_t off)
+{
+    while (len > 0) {
+        ssize_t n = pread(fd, buf, len, off);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        buf += n;
+        len -= n;
+        off += n;
+    }
+    return 0;
+}
+
+/* Log the bytes of both files around the first difference at off */
+static void log_content_diff(const char *path1, const char *path2,
+                             int fd1, int fd2, off_t off, off_t size)
+{
+    char buf1[FCONTENT_CONTEXT * 2], buf2[FCONTENT_CONTEXT * 2];
+    char hex1[sizeof(buf1) * 3 + 1] = {0}, hex2[sizeof(buf2) * 3 + 1] = {0};
+    off_t begin = off > FCONTENT_CONTEXT ? off - FCONTENT_CONTEXT : 0;
+    size_t len = min(sizeof(buf1), (size_t)(size - begin));
+
+    logwarn("[seqid=%zu] content in '%s' and '%s' first differs at offset "
+            "%ld (0x%lx) of %ld bytes", count, path1, path2, (long)off,
+            (long)off, (long)size);
+    if (read_full(fd1, buf1, len, begin) != 0 ||
+            read_full(fd2, buf2, len, begin) != 0)
+        return;
+    for (size_t i = 0; i < len; ++i) {
+        sprintf(hex1 + i * 3, "%02x ", (unsigned char)buf1[i]);
+        sprintf(hex2 + i * 3, "%02x ", (unsigned char)buf2[i]);
+    }
+    logwarn("  %s @%ld: %s", path1, (long)begin, hex1);
+    logwarn("  %s @%ld: %s", path2, (long)begin, hex2);
+}
+
+/*
+ * Compare the content of two files: 0 if equal, 1 if they differ (the
+ * first differing offset and the bytes around it are logged), and -1 on
+ * error.  Both files are mapped, or read in FCONTENT_BLOCK_SIZE blocks if
+ * the file system cannot mmap them.
+ */
 int compare_file_content(const char *path1, const char *path2)
 {
-    const size_t bs = 4096;
-    char buf1[bs], buf2[bs];
     struct stat f1, f2;
     int fd1 = -1, fd2 = -1, ret = 0;
+    char *map1 = MAP_FAILED, *map2 = MAP_FAILED;
+    char *buf1 = NULL, *buf2 = NULL;
+    ssize_t diff = -1;
+    off_t diff_off = -1;
     /* Open the two files */
     fd1 = open(path1, O_RDONLY);
     if (fd1 < 0) {
@@ -64,7 +133,7 @@ int compare_file_content(const char *path1, const char *path2)
     }
     fd2 = open(path2, O_RDONLY);
     if (fd2 < 0) {
-        logerr("[seqid=%zu] cannot open %s", count, path1);
+        logerr("[seqid=%zu] cannot open %s", count, path2);
         close(fd1);
         return -1;
     }
@@ -88,23 +157,47 @@ int compare_file_content(const char *path1, const char *path2)
         ret = 1;
         goto end;
     }
+    if (f1.st_size == 0)
+        goto end;
     /* Compare the file content */
-    int r1 = 0, r2 = 0;
-    lseek(fd1, 0, SEEK_SET);
-    lseek(fd2, 0, SEEK_SET);
-    while ((r1 = read(fd1, buf1, bs)) > 0 && (r2 = read(fd2, buf2, bs)) > 0) {
-        if (memcmp(buf1, buf2, r1) != 0) {
-            logwarn("[seqid=%zu] content in '%s' and '%s' "
-                    "is not equal.\n", count, path1, path2);
-            ret = -1;
-	    break;
+    map1 = mmap(NULL, f1.st_size, PROT_READ, MAP_PRIVATE, fd1, 0);
+    if (map1 != MAP_FAILED)
+        map2 = mmap(NULL, f2.st_size, PROT_READ, MAP_PRIVATE, fd2, 0);
+    if (map2 != MAP_FAILED) {
+        diff = first_diff(map1, map2, f1.st_size);
+        diff_off = diff;
+    } else {
+        size_t bs = min((size_t)f1.st_size, FCONTENT_BLOCK_SIZE);
+        buf1 = myheap_malloc(bs);
+        buf2 = myheap_malloc(bs);
+        if (!buf1 || !buf2)
+            mem_alloc_err();
+        for (off_t off = 0; off < f1.st_size; off += bs) {
+            size_t n = min(bs, (size_t)(f1.st_size - off));
+            if (read_full(fd1, buf1, n, off) != 0 ||
+                    read_full(fd2, buf2, n, off) != 0) {
+                logerr("[seqid=%zu] error occurred when reading.", count);
+                ret = -1;
+                goto end;
+            }
+            diff = first_diff(buf1, buf2, n);
+            if (diff >= 0) {
+                diff_off = off + diff;
+                break;
+            }
         }
     }
-    if (r1 < 0 || r2 < 0) {
-        logerr("[seqid=%zu] error occurred when reading.", count);
-        ret = -1;
+    if (diff_off >= 0) {
+        log_content_diff(path1, path2, fd1, fd2, diff_off, f1.st_size);
+        ret = 1;
     }
 end:
+    if (map1 != MAP_FAILED)
+        munmap(map1, f1.st_size);
+    if (map2 != MAP_FAILED)
+        munmap(map2, f2.st_size);
+    myheap_free(buf1);
+    myheap_free(buf2);
     if (fd1 >= 0)
         close(fd1);
     if (fd2 >= 0)
@@ -234,6 +327,71 @@ static void tell_absfs_hash_method()
     fprintf(stderr, "Selected abstraction hash method is %s.\n", hashname);
 }
 
+/* File systems that compute their own abstract state; a file system is
+ * dropped from this the first time it fails to, and gets scanned instead */
+static bool native_absfs[MAX_FS];
+/* Set MCFS_ABSFS_SELFCHECK to also scan the file systems above and check
+ * that both ways agree */
+static bool absfs_selfcheck;
+
+const char *verifs_ioctl_path(int i)
+{
+    if (is_nfs_ganesha_verifs2(get_fslist()[i]))
+        return NFS_GANESHA_EXPORT_PATH;
+    if (is_nfs_verifs2(get_fslist()[i]))
+        return NFS_EXPORT_PATH;
+    return get_basepaths()[i];
+}
+
+static int get_verifs_abstract_state(const char *mp, absfs_state_t state)
+{
+    int mpfd = open(mp, O_RDONLY | __O_DIRECTORY);
+    if (mpfd < 0) {
+        logerr("Cannot open mountpoint %s", mp);
+        return errno;
+    }
+
+    struct verifs_absfs arg = {.hash_option = absfs_hash_method};
+    int ret = ioctl(mpfd, VERIFS_ABSTRACT_STATE, &arg);
+    if (ret < 0) {
+        ret = errno;
+    } else {
+        memcpy(state, arg.state, sizeof(absfs_state_t));
+    }
+    close(mpfd);
+    return ret;
+}
+
+void compute_fs_abstract_state(int i, absfs_state_t state)
+{
+    if (!native_absfs[i]) {
+        compute_abstract_state(get_basepaths()[i], state);
+        return;
+    }
+    int ret = get_verifs_abstract_state(verifs_ioctl_path(i), state);
+    if (ret != 0) {
+        logwarn("%s cannot compute its abstract state (%s), scanning it "
+                "from now on", get_fslist()[i], errnoname(ret));
+        native_absfs[i] = false;
+        compute_abstract_state(get_basepaths()[i], state);
+        return;
+    }
+    if (absfs_selfcheck) {
+        absfs_state_t scanned;
+        compute_abstract_state(get_basepaths()[i], scanned);
+        if (memcmp(state, scanned, sizeof(absfs_state_t)) != 0) {
+            logerr("[seqid=%zu] abstract state of %s from the file system "
+                   "differs from the scanned one", count, get_fslist()[i]);
+            submit_error("native=");
+            print_abstract_fs_state(submit_error, state);
+            submit_error(", scanned=");
+            print_abstract_fs_state(submit_error, scanned);
+            submit_error("\n");
+            dump_absfs(get_basepaths()[i]);
+        }
+    }
+}
+
 bool compare_equality_absfs(char **fses, int n_fs, absfs_state_t *absfs)
 {
     bool res = true;
@@ -243,7 +401,7 @@ bool compare_equality_absfs(char **fses, int n_fs, absfs_state_t *absfs)
 retry:
     /* Calculate the abstract file system states */
     for (int i = 0; i < n_fs; ++i) {
-        compute_abstract_state(get_basepaths()[i], absfs[i]);
+        compute_fs_abstract_state(i, absfs[i]);
     }
     /* New: record abstract states in the main log */
     static size_t prev_seqid = 0;
@@ -278,6 +436,8 @@ retry:
             print_abstract_fs_state(submit_error, absfs[i]);
             submit_error("\n");
         }
+        /* Point at the files whose data differ, if any */
+        report_fcontent_diffs(fses, n_fs);
     } else if (!res && retry_limit > 0) {
         retry_limit--;
         res = true;
@@ -342,6 +502,33 @@ bool compare_equality_fcontent(char **fses, int n_fs, char **fpaths)
     return res;
 }
 
+/*
+ * Compare the content of every test file that exists in all the file
+ * systems, and log where each pair first differs.  This narrows down an
+ * abstract state discrepancy to the file data.
+ */
+void report_fcontent_diffs(char **fses, int n_fs)
+{
+    int nfiles = enable_fdpool ? get_fpoolsize() : 1;
+    for (int k = 0; k < nfiles; ++k) {
+        char *paths[MAX_FS];
+        bool all_exist = true;
+        for (int i = 0; i < n_fs; ++i) {
+            paths[i] = enable_fdpool ? get_filepool()[i][k] : get_testfiles()[i];
+            if (!paths[i] || !check_file_existence(paths[i]))
+                all_exist = false;
+        }
+        if (!all_exist)
+            continue;
+        for (int i = 1; i < n_fs; ++i) {
+            if (compare_file_content(paths[i-1], paths[i]) > 0) {
+                logwarn("[seqid=%zu] [%s] and [%s] differ in file data",
+                        count, fses[i-1], fses[i]);
+            }
+        }
+    }
+}
+
 void show_open_flags(uint64_t flags)
 {
     /* RDONLY, WRONLY and RDWR */
@@ -533,17 +720,8 @@ static void unmap_devices()
 #ifdef FILEDIR_POOL
 static void precreate_pools()
 {
-    // Using srand(time(NULL)); will (likely) make each VT have a same 
-    // starting point.  The following code uses a more granular time
-    // to seed the random number generator.
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    unsigned long time_in_micros = 1000000 * tv.tv_sec + tv.tv_usec;
-    srand(time_in_micros);
-    
     double fs_exist_prob = FILEDIR_EXIST_PROB;
-    size_t path_len;
-    char *path_name;
+    char path_name[PATH_MAX];
     FILE * fp;
     char dump_fn[PATH_MAX];
     sprintf(dump_fn, "dump_prepopulate_%u.log", globals_t_p->_swarm_id);
@@ -555,23 +733,20 @@ static void precreate_pools()
     // Mount all the file systems first
     mountall();
     for (int i = 0; i < combo_pool_idx; ++i) {
-        if (rand() <  fs_exist_prob * ((double)RAND_MAX + 1.0)) {
+        if (mcfs_prng_double() < fs_exist_prob) {
             fprintf(fp, "%s\n", bfs_fd_pool[i]);
             for (int j = 0; j < get_n_fs(); ++j) {
-                path_len = snprintf(NULL, 0, "%s%s", get_basepaths()[j], bfs_fd_pool[i]);
-                path_name = calloc(1, path_len + 1);
-                if (!path_name) {
-                    fprintf(stderr, "calloc error happened for prepopulation pathname!\n");
+                if (tc_path_joinall(path_name, PATH_MAX, get_basepaths()[j],
+                                    bfs_fd_pool[i]) < 0) {
+                    fprintf(stderr, "prepopulation pathname is too long!\n");
                     exit(EXIT_FAILURE);
                 }
-                snprintf(path_name, path_len + 1, "%s%s", get_basepaths()[j], bfs_fd_pool[i]);
                 int ret = -1;
                 ret = mkdir_p(path_name, 0755, 0644);
                 if (ret < 0) {
                     fprintf(stderr, "mkdir_p error happened!\n");
                     exit(EXIT_FAILURE);
                 }
-                free(path_name);
             }
         }
     }
@@ -595,7 +770,10 @@ static int checkpoint_verifs(size_t key, const char *mp)
     }
 
     int ret = ioctl(mpfd, VERIFS_CHECKPOINT, key);
-    if (ret < 0) {
+    if (ret < 0 && errno == ENOSPC) {
+        logerr("Cannot perform checkpoint at %s: state pool is full", mp);
+        ret = errno;
+    } else if (ret < 0) {
         logerr("Cannot perform checkpoint at %s", mp);
         ret = errno;
     }
@@ -621,6 +799,56 @@ static int restore_verifs(size_t key, const char *mp)
     return ret;
 }
 
+#ifdef CBUF_IMAGE
+/* Pages of each device written since the previous checkpoint, as reported
+ * by brd, so that the image ring only copies those */
+static uint64_t *dirty_pages[MAX_FS];
+/* Devices that cannot report dirty pages (e.g., not brd) */
+static bool no_dirty_pages[MAX_FS];
+
+static const uint64_t *fetch_dirty_pages(int i)
+{
+    if (!get_devlist()[i] || no_dirty_pages[i])
+        return NULL;
+    size_t npages = (get_devsize_kb()[i] * 1024 + CBUF_PAGE_SIZE - 1) /
+                    CBUF_PAGE_SIZE;
+    if (!dirty_pages[i]) {
+        dirty_pages[i] = myheap_calloc(CBUF_BITMAP_WORDS(npages),
+                                       sizeof(uint64_t));
+        if (!dirty_pages[i])
+            mem_alloc_err();
+    }
+    struct brd_dirty_bitmap arg = {
+        .nr_pages = npages,
+        .bitmap = (uintptr_t)dirty_pages[i],
+    };
+    if (ioctl(get_fsfds()[i], BRD_GET_DIRTY, &arg) != 0 ||
+        arg.nr_pages != npages) {
+        makelog("%s cannot report dirty pages (%s), copying whole images\n",
+                get_devlist()[i], errnoname(errno));
+        no_dirty_pages[i] = true;
+        return NULL;
+    }
+    return dirty_pages[i];
+}
+
+/*
+ * SPIN's restore rewrites every page of the mapped devices, mostly with the
+ * data they already hold.  While it runs, brd compares each write with the
+ * page so that only the pages that really change are reported dirty.
+ * Turning it off flushes the restored pages first.
+ */
+static void compare_device_writes(bool on)
+{
+    for (int i = 0; i < get_n_fs(); ++i) {
+        if (!get_devlist()[i] || no_dirty_pages[i])
+            continue;
+        /* Other block devices do not know the ioctl; nothing to do there */
+        ioctl(get_fsfds()[i], BRD_COMPARE_WRITES, on ? 1 : 0);
+    }
+}
+#endif
+
 static size_t state_depth = 0;
 
 /*
@@ -636,7 +864,7 @@ static long checkpoint_before_hook(unsigned char *ptr)
 #ifdef CBUF_IMAGE
     for (int i = 0; i < get_n_fs(); ++i) {
         insert_circular_buf(fsimg_bufs, i, get_devsize_kb()[i], get_fsimgs()[i],
-            state_depth, count, IS_CHECKPOINT);
+            fetch_dirty_pages(i), state_depth, count, IS_CHECKPOINT);
     }
 #endif
 
@@ -687,6 +915,9 @@ static long restore_before_hook(unsigned char *ptr)
     makelog("[seqid = %d] restore (%zu)\n", count, state_depth);
 
     mmap_devices(IS_SNAPSHOT);
+#ifdef CBUF_IMAGE
+    compare_device_writes(true);
+#endif
 
     for (int i = 0; i < get_n_fs(); ++i) {
         if (!is_verifs(get_fslist()[i]))
@@ -716,7 +947,13 @@ static long restore_before_hook(unsigned char *ptr)
  */
 static long restore_after_hook(unsigned char *ptr)
 {
+#ifdef CBUF_IMAGE
+    compare_device_writes(false);
+#endif
     unmap_devices();
+    novelty_drop_pending();
+    /* The states on the stack were all expanded by this VT */
+    partition_pruned = false;
     // assert(do_fsck());
     // dump_fs_images("after-restore");
     return 0;
@@ -727,7 +964,12 @@ static long restore_after_hook(unsigned char *ptr)
  */
 static long update_before_hook(unsigned char *ptr)
 {
-    absfs_set_add(absfs_set, get_absfs());
+    int added = absfs_set_add(absfs_set, get_absfs());
+    if (novelty_mode)
+        novelty_feedback(added);
+    if (added && dedup_mode)
+        dedup_submit(get_absfs());
+    partition_visit(get_absfs(), state_depth);
     return 0;
 }
 
@@ -839,13 +1081,17 @@ static void main_hook(int argc, char **argv)
     tell_absfs_hash_method();
     /* Fill initial abstract states */
     for (int i = 0; i < get_n_fs(); ++i) {
-        compute_abstract_state(get_basepaths()[i], get_absfs()[i]);
+        compute_fs_abstract_state(i, get_absfs()[i]);
     }
 }
 
 void __attribute__((constructor)) init()
 {
-    fsinfos = calloc(get_n_fs(), sizeof(struct fs_stat));
+#ifdef MCFS_CUSTOM_HEAP
+    /* First, so that everything allocated from here on can live there */
+    try_init_myheap();
+#endif
+    fsinfos = myheap_calloc(get_n_fs(), sizeof(struct fs_stat));
     if (!fsinfos)
         mem_alloc_err();
     char output_log_name[NAME_MAX] = {0};
@@ -853,7 +1099,8 @@ void __attribute__((constructor)) init()
     char seq_log_name[NAME_MAX] = {0};
     char progname[NAME_MAX] = {0};
     ssize_t progname_len;
-    // try_init_myheap();
+    /* Seed before any input is picked, including the pre-created pools */
+    uint64_t seed = mcfs_prng_init();
     setup_filesystems();
 #ifdef FILEDIR_POOL
     /* Pre-create files and dirs from pools AFTER fs setup */
@@ -875,6 +1122,63 @@ void __attribute__((constructor)) init()
     add_ts_to_logname(error_log_name, NAME_MAX, ERROR_PREFIX, progname, "");
     add_ts_to_logname(seq_log_name, NAME_MAX, SEQ_PREFIX, progname, "");
     init_log_daemon(output_log_name, error_log_name, seq_log_name);
+    /* Log the seed so that the run and its replay can be repeated */
+    makelog("PRNG seed = %" PRIu64 " (set " MCFS_SEED_ENV " to repeat)\n",
+            seed);
+    submit_seq("seed, %" PRIu64 "\n", seed);
+    if (myheap_ready())
+        makelog("Custom heap: %s\n", getenv(CUSTOM_HEAP_PATH_ENV) ?
+                getenv(CUSTOM_HEAP_PATH_ENV) : "anonymous mapping");
+
+    for (int i = 0; i < get_n_fs(); ++i) {
+        native_absfs[i] = is_verifs(get_fslist()[i]);
+    }
+    absfs_selfcheck = (getenv("MCFS_ABSFS_SELFCHECK") != NULL);
+    if (getenv(ABSFS_XATTR_ENV)) {
+        absfs_set_xattr_mode(true);
+        /* The VeriFS ioctl does not hash xattrs, so walk VeriFS too */
+        for (int i = 0; i < get_n_fs(); ++i)
+            native_absfs[i] = false;
+        makelog("Extended attributes are part of the abstract state\n");
+    }
+#ifdef MCFS_BATCH
+    batch_ops = BATCH_DEFAULT_OPS;
+    if (getenv(BATCH_OPS_ENV))
+        batch_ops = atoi(getenv(BATCH_OPS_ENV));
+    if (batch_ops < 1)
+        batch_ops = 1;
+    batch_check_each = (getenv(BATCH_CHECK_EACH_ENV) != NULL);
+    makelog("Batch mode: %d operations per mount cycle\n", batch_ops);
+#endif
+    novelty_init();
+    if (novelty_mode)
+        makelog("Novelty-driven input selection enabled\n");
+    conc_init();
+#ifdef MCFS_CONC
+    if (conc_threads > 1)
+        makelog("Concurrent mode: %d threads, %d operations each\n",
+                conc_threads, conc_ops);
+#else
+    if (conc_threads > 1) {
+        logwarn("%s is ignored: the model was built without make CONC=1",
+                CONC_THREADS_ENV);
+    }
+#endif
+    dedup_init(globals_t_p->_swarm_id);
+    if (dedup_mode)
+        makelog("Global dedup through the coordinator at %s\n",
+                getenv(DEDUP_ADDR_ENV));
+#ifdef MCFS_PARTITION_PRUNE
+    partition_init(globals_t_p->_swarm_id);
+    if (partition_policy != PARTITION_OFF)
+        makelog("State-space partitioning: %s policy, VT %d\n",
+                getenv(PARTITION_ENV), globals_t_p->_swarm_id);
+#else
+    if (getenv(PARTITION_ENV)) {
+        logwarn("%s is ignored: the model was built without "
+                "make PARTITION=1", PARTITION_ENV);
+    }
+#endif
 
     /* Register hooks */
     c_stack_before = checkpoint_before_hook;
@@ -909,13 +1213,22 @@ void __attribute__((constructor)) init()
 void __attribute__((destructor)) cleanup()
 {
     if (fsinfos)
-        free(fsinfos);
+        myheap_free(fsinfos);
     fflush(stdout);
     fflush(stderr);
-    unset_myheap();
+    conc_destroy();
+    partition_destroy();
+    dedup_destroy();
+    if (novelty_mode)
+        novelty_dump(submit_message);
     destroy_log_daemon();
     // unfreeze_all();
 #ifdef CBUF_IMAGE
     cleanup_cir_bufs(fsimg_bufs);
+    for (int i = 0; i < MAX_FS; ++i) {
+        myheap_free(dirty_pages[i]);
+    }
 #endif
+    /* Last, as the steps above may still free heap memory */
+    unset_myheap();
 }
@@ -10,6 +10,11 @@
  */
 
 #include "setup.h"
+#include "novelty.h"
+#include "concurrent.h"
+#include "partition.h"
+#include "dedup.h"
+#include "custom_heap.h"
 
 #ifndef _FILEUTIL_H_
 #define _FILEUTIL_H_
@@ -39,6 +44,24 @@ extern int absfs_hash_method;
 extern bool enable_fdpool;
 extern bool enable_complex_ops;
 
+/* Batch mode (pan built with -DMCFS_BATCH): the batch transition replaces
+ * the single-operation ones it covers, and runs batch_ops operations
+ * between one mountall() and unmount_all_strict().  Set with
+ * MCFS_BATCH_OPS. */
+#define BATCH_OPS_ENV "MCFS_BATCH_OPS"
+#define BATCH_DEFAULT_OPS 8
+#define BATCH_CHECK_EACH_ENV "MCFS_BATCH_CHECK_EACH"
+#define ABSFS_XATTR_ENV "MCFS_ABSFS_XATTR"
+enum batch_op {BATCH_CREATE, BATCH_WRITE, BATCH_TRUNCATE, BATCH_UNLINK,
+               BATCH_MKDIR, BATCH_RMDIR, BATCH_CHMOD, BATCH_NR_OPS};
+extern int batch_ops;
+extern bool batch_check_each;
+
+/* compare_file_content(): block size when the files cannot be mapped, and
+ * bytes logged on each side of the first difference */
+#define FCONTENT_BLOCK_SIZE (1UL << 20)
+#define FCONTENT_CONTEXT 16
+
 #ifdef CBUF_IMAGE
 extern circular_buf_sum_t *fsimg_bufs;
 #endif
@@ -50,6 +73,9 @@ struct fs_stat {
     size_t total_inodes;
     size_t free_inodes;
     size_t block_size;
+    /* Checkpointed states held by VeriFS, see VERIFS_POOL_STAT */
+    size_t pool_states;
+    size_t pool_bytes;
 };
 
 struct imghash {
@@ -92,6 +118,12 @@ static inline void compute_abstract_state(const char *basepath,
     destroy_abstract_fs(&absfs);
 }
 
+/* Where to send VeriFS ioctls for the i-th file system */
+const char *verifs_ioctl_path(int i);
+
+/* Like compute_abstract_state(), but lets VeriFS compute it by itself */
+void compute_fs_abstract_state(int i, absfs_state_t state);
+
 #define makecall(retvar, err, argfmt, funcname, ...) \
     count++; \
     memset(func, 0, FUNC_NAME_LEN + 1); \
@@ -165,7 +197,7 @@ static inline void dump_all_cbufs()
 /* Randomly pick a value in the range of [min, max] */
 static inline size_t pick_value(size_t min, size_t max, size_t step)
 {
-    return min + rand() / (RAND_MAX / (max - min + 1) + 1) / step * step;
+    return min + mcfs_prng_below(max - min + 1) / step * step;
 }
 
 enum fill_type {PATTERN, ONES, BYTE_REPEAT, RANDOM_EACH_BYTE};
@@ -173,7 +205,7 @@ enum fill_type {PATTERN, ONES, BYTE_REPEAT, RANDOM_EACH_BYTE};
 /* Randomly pick a value in the range of [min, max] without steps */
 static inline size_t pick_random(size_t min, size_t max)
 {
-   return min + rand() / (RAND_MAX / (max - min + 1) + 1);
+   return mcfs_prng_range(min, max);
 }
 
 /* Generate data into a given buffer.
@@ -206,7 +238,7 @@ static inline void generate_data(char *buffer, size_t len, size_t offset, enum f
     case RANDOM_EACH_BYTE:
     {
         size_t i = 0, remaining = len;
-        int n = rand();
+        int n = (int)mcfs_prng_next();
         while (remaining > 0) {
             int *ptr = (int *)(buffer + i);
             *ptr = n;
@@ -252,6 +284,7 @@ bool compare_equality_fcontent(char **fses, int n_fs, char **fpaths);
 bool compare_equality_absfs(char **fses, int n_fs, absfs_state_t *absfs);
 bool compare_equality_file_xattr(char **fses, int n_fs, char **xfpaths);
 int compare_file_content(const char *path1, const char *path2);
+void report_fcontent_diffs(char **fses, int n_fs);
 
 void show_open_flags(uint64_t flags);
 int myopen(const char *pathname, int flags, mode_t mode);
@@ -19,6 +19,7 @@ time_lengths = ['30mins', '60mins']
 
 fsops = ['create_file',
          'write_file',
+         'write_file_byte',
          'truncate',
          'unlink',
          'mkdir',
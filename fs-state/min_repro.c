@@ -89,7 +89,7 @@ int main(int argc, char **argv)
     ssize_t len;
     long loop_num = 0;
 
-    srand(time(NULL));
+    mcfs_prng_init();
 
     // Read sequence file from bottom to top
     seqfp = fopen(seqlog, "r");
@@ -124,50 +124,18 @@ int main(int argc, char **argv)
         char *linebuf = NULL;
         // Read the file from the offset
         while ((len = getline(&linebuf, &linecap, seqfp)) >= 0) {
-            // Copy the line
-            char *line = malloc(len + 1);
-            line[len] = '\0';
-            strncpy(line, linebuf, len);
-            /* remove the newline character */
-            if (line[len - 1] == '\n')
-                line[len - 1] = '\0';
-            /* parse the line */
-            vector_t argvec;
-            extract_fields(&argvec, line, ", ");
-            char *funcname = *vector_get(&argvec, char *, 0);
+            // Parse the line in place
+            struct replay_op op;
+            if (parse_replay_line(linebuf, &op) != 0) {
+                printf("Unrecognized op: %s\n", op.name ? op.name : "");
+                exit(1);
+            }
             // Mount the file systems
             mountall();
-            if (strncmp(funcname, "create_file", len) == 0) {
-                do_create_file(&argvec);
-                ++ops_cnt;
-            } else if (strncmp(funcname, "write_file", len) == 0) {
-                do_write_file(&argvec, loop_num % 256);
-                ++ops_cnt;
-            } else if (strncmp(funcname, "truncate", len) == 0) {
-                do_truncate(&argvec);
-                ++ops_cnt;
-            } else if (strncmp(funcname, "unlink", len) == 0) {
-                do_unlink(&argvec);
-                ++ops_cnt;
-            } else if (strncmp(funcname, "mkdir", len) == 0) {
-                do_mkdir(&argvec);
-                ++ops_cnt;
-            } else if (strncmp(funcname, "rmdir", len) == 0) {
-                do_rmdir(&argvec);
-                ++ops_cnt;
-            } else if (strncmp(funcname, "rename", len) == 0) {
-                do_rename(&argvec);
-                ++ops_cnt;
-            } else if (strncmp(funcname, "symlink", len) == 0) {
-                do_symlink(&argvec);
-                ++ops_cnt;
-            } else if (strncmp(funcname, "link", len) == 0) {
-                do_link(&argvec);
-                ++ops_cnt;
-            } else if (strncmp(funcname, "checkpoint", len) != 0 && 
-                    strncmp(funcname, "restore", len) != 0) {
-                printf("Unrecognized op: %s\n", funcname);
-                exit(1);
+            if (op.code != OP_CHECKPOINT && op.code != OP_RESTORE) {
+                exec_replay_op(&op, loop_num % 256);
+                if (is_replay_fsop(&op))
+                    ++ops_cnt;
             }
             // Calculate and compare abstract state for two file systems
             if (ops_cnt == get_n_fs()) {
@@ -190,8 +158,6 @@ int main(int argc, char **argv)
             }
             // Unmount the file systems
             unmount_all_strict();
-            free(line);
-            destroy_fields(&argvec);
         }
         if (linebuf) {
             free(linebuf);
@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2020-2024 Yifei Liu
+ * Copyright (c) 2020-2024 Wei Su
+ * Copyright (c) 2020-2024 Erez Zadok
+ * Copyright (c) 2020-2024 Stony Brook University
+ * Copyright (c) 2020-2024 The Research Foundation of SUNY
+ *
+ * You can redistribute it and/or modify it under the terms of the Apache
+ * License, Version 2.0 (http://www.apache.org/licenses/LICENSE-2.0).
+ */
+
+#include "fileutil.h"
+#include "novelty.h"
+#include <inttypes.h>
+
+struct novelty_arm {
+    uint64_t picks;
+    uint64_t hits;
+};
+
+struct novelty_param {
+    const char *name;
+    int nbuckets;
+    struct novelty_arm arms[NOVELTY_MAX_BUCKETS];
+};
+
+bool novelty_mode = false;
+uint64_t novelty_picks = 0;
+uint64_t novelty_hits = 0;
+
+static double novelty_floor = NOVELTY_DEFAULT_FLOOR;
+static struct novelty_param params[NOVELTY_MAX_PARAMS];
+static int nparams;
+
+static struct {
+    int param;
+    int bucket;
+} pending[NOVELTY_MAX_PENDING];
+static int npending;
+/* Value of the operation counter when the pending picks were made */
+static size_t pending_count;
+
+void novelty_init()
+{
+    const char *floor = getenv(NOVELTY_FLOOR_ENV);
+#ifdef MCFS_NOVELTY
+    novelty_mode = true;
+#else
+    /* The pickers of this pan branch over all values */
+    if (getenv(NOVELTY_ENV)) {
+        logwarn("%s is ignored: build pan with make NOVELTY=1",
+                NOVELTY_ENV);
+    }
+#endif
+    if (floor) {
+        novelty_floor = strtod(floor, NULL);
+        if (novelty_floor < 0 || novelty_floor > 1)
+            novelty_floor = NOVELTY_DEFAULT_FLOOR;
+    }
+}
+
+int novelty_register(const char *name, int nbuckets)
+{
+    for (int i = 0; i < nparams; ++i) {
+        if (strcmp(params[i].name, name) == 0)
+            return i;
+    }
+    assert(nparams < NOVELTY_MAX_PARAMS);
+    params[nparams].name = name;
+    params[nparams].nbuckets = min(nbuckets, NOVELTY_MAX_BUCKETS);
+    return nparams++;
+}
+
+/* Laplace-smoothed rate of new states per pick */
+static double arm_score(const struct novelty_arm *arm)
+{
+    return (arm->hits + 1.0) / (arm->picks + 2.0);
+}
+
+/*
+ * Pick a value: bucket b is drawn with probability
+ *   floor / n + (1 - floor) * score(b) / sum(score)
+ * so productive buckets are preferred but none is ever starved.  If there
+ * are more values than buckets, adjacent values share a bucket.
+ */
+int novelty_pick(int param, const int *values, int nvalues)
+{
+    struct novelty_param *p = &params[param];
+    int n = p->nbuckets;
+    double total = 0.0;
+    double u;
+    int bucket = n - 1;
+
+    for (int b = 0; b < n; ++b) {
+        total += arm_score(&p->arms[b]);
+    }
+    u = mcfs_prng_double();
+    for (int b = 0; b < n; ++b) {
+        u -= novelty_floor / n +
+             (1 - novelty_floor) * arm_score(&p->arms[b]) / total;
+        if (u < 0) {
+            bucket = b;
+            break;
+        }
+    }
+
+    p->arms[bucket].picks++;
+    novelty_picks++;
+    if (npending < NOVELTY_MAX_PENDING) {
+        pending[npending].param = param;
+        pending[npending].bucket = bucket;
+        npending++;
+    }
+    pending_count = count;
+
+    /* Spread the values of the bucket evenly */
+    int lo = bucket * nvalues / n;
+    int hi = (bucket + 1) * nvalues / n;
+    if (hi <= lo)
+        return values[lo];
+    return values[lo + mcfs_prng_below(hi - lo)];
+}
+
+/*
+ * Called whenever SPIN stores a state.  The picks are only judged once
+ * an operation has run since they were made (the picking steps of the
+ * worker are transitions on their own).
+ */
+void novelty_feedback(bool new_state)
+{
+    if (npending == 0 || count == pending_count)
+        return;
+    if (new_state) {
+        for (int i = 0; i < npending; ++i) {
+            params[pending[i].param].arms[pending[i].bucket].hits++;
+        }
+        novelty_hits++;
+    }
+    npending = 0;
+}
+
+/* Forget the picks of a path SPIN backtracked from */
+void novelty_drop_pending()
+{
+    npending = 0;
+}
+
+void novelty_dump(int (*printer)(const char *fmt, ...))
+{
+    for (int i = 0; i < nparams; ++i) {
+        printer("novelty %s:", params[i].name);
+        for (int b = 0; b < params[i].nbuckets; ++b) {
+            printer(" %" PRIu64 "/%" PRIu64, params[i].arms[b].hits,
+                    params[i].arms[b].picks);
+        }
+        printer("\n");
+    }
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2020-2024 Yifei Liu
+ * Copyright (c) 2020-2024 Wei Su
+ * Copyright (c) 2020-2024 Erez Zadok
+ * Copyright (c) 2020-2024 Stony Brook University
+ * Copyright (c) 2020-2024 The Research Foundation of SUNY
+ *
+ * You can redistribute it and/or modify it under the terms of the Apache
+ * License, Version 2.0 (http://www.apache.org/licenses/LICENSE-2.0).
+ */
+
+#ifndef _NOVELTY_H_
+#define _NOVELTY_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Novelty-driven input selection.  Every parameter in parameters.pml is a
+ * set of buckets (one per value).  When pan is built with -DMCFS_NOVELTY,
+ * the pickers draw a bucket from a bandit instead of branching over all of
+ * them, and a bucket is rewarded whenever the operation that used it leads
+ * to an abstract state not seen before.
+ */
+/* Only warns that the build lacks -DMCFS_NOVELTY */
+#define NOVELTY_ENV "MCFS_NOVELTY"
+/* Share of the picks spread uniformly over all buckets (0 to 1) */
+#define NOVELTY_FLOOR_ENV "MCFS_NOVELTY_FLOOR"
+#define NOVELTY_DEFAULT_FLOOR 0.1
+
+#define NOVELTY_MAX_PARAMS 32
+#define NOVELTY_MAX_BUCKETS 64
+/* Picks waiting for feedback, i.e., made since the last operation */
+#define NOVELTY_MAX_PENDING 32
+
+extern bool novelty_mode;
+/* Totals reported in the perf CSV */
+extern uint64_t novelty_picks;
+extern uint64_t novelty_hits;
+
+void novelty_init();
+int novelty_register(const char *name, int nbuckets);
+int novelty_pick(int param, const int *values, int nvalues);
+void novelty_feedback(bool new_state);
+void novelty_drop_pending();
+void novelty_dump(int (*printer)(const char *fmt, ...));
+
+#endif // _NOVELTY_H_
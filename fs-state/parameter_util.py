@@ -115,15 +115,50 @@ class NearvalueParameters():
         return str(self.params)    
 
 
+# The picker is selected when pan is built: by default SPIN branches over all
+# the values, and with -DMCFS_NOVELTY (see novelty.h) the value is drawn by
+# the bandit in C and passed back through the hidden variable
+# novelty_pick_val.
 def generate_params_pml(obj):
     params = list(obj.param_set)
     params.sort()
-    inline_name = 'pick_' + type(obj).__name__
+    name = type(obj).__name__
+    inline_name = 'pick_' + name
     result = 'inline %s(value) {\n' % inline_name
+    result += '#ifdef MCFS_NOVELTY\n'
+    result += '\tc_code {\n'
+    result += '\t\tstatic const int values[] = {%s};\n' % \
+        ', '.join(str(p) for p in params)
+    result += '\t\tstatic int param = -1;\n'
+    result += '\t\tif (param < 0)\n'
+    result += '\t\t\tparam = novelty_register("%s", %d);\n' % \
+        (name, len(params))
+    result += '\t\tnovelty_pick_val = novelty_pick(param, values, %d);\n' % \
+        len(params)
+    result += '\t};\n'
+    result += '\tvalue = novelty_pick_val;\n'
+    result += '#else\n'
     result += '\tif\n'
     for p in params:
         result += '\t\t:: value = %d;\n' % p
     result += '\tfi\n'
+    result += '#endif\n'
+    result += '}\n'
+    return result
+
+
+# The same values for C code that draws parameters itself with the driver's
+# PRNG (e.g., the operations of a batch), without SPIN branching over them.
+def generate_params_c(obj):
+    params = list(obj.param_set)
+    params.sort()
+    name = type(obj).__name__
+    result = 'static const int %s_values[] = {%s};\n' % \
+        (name, ', '.join(str(p) for p in params))
+    result += 'static inline int param_%s(void)\n' % name
+    result += '{\n'
+    result += '    return %s_values[mcfs_prng_below(%d)];\n' % \
+        (name, len(params))
     result += '}\n'
     return result
 
@@ -142,7 +177,8 @@ def make_params_pml(name, *param_generators):
         '__call__': generate_params_pml,
         '__len__': lambda obj: len(obj.param_set),
         'get_params': lambda obj: obj.param_set,
-        'generate': generate_params_pml
+        'generate': generate_params_pml,
+        'generate_c': generate_params_c
     })
     return cls(*param_generators)
 
@@ -112,10 +112,19 @@ chown_group = make_params_pml('chown_group',
 
 if __name__ == '__main__':
     symbols = dict(globals())
+    params = [v for k, v in symbols.items() if k == type(v).__name__]
     f = open('parameters.pml', 'w')
-    for k, v in symbols.items():
-        if k == type(v).__name__:
-            f.write(v())
+    for v in params:
+        f.write(v())
 
     f.close()
 
+    f = open('parameters.h', 'w')
+    f.write('/* Generated by parameters.py */\n')
+    f.write('#ifndef _PARAMETERS_H_\n#define _PARAMETERS_H_\n\n')
+    f.write('#include "prng.h"\n\n')
+    for v in params:
+        f.write(v.generate_c())
+    f.write('\n#endif // _PARAMETERS_H_\n')
+    f.close()
+
@@ -0,0 +1,243 @@
+/*
+ * Copyright (c) 2020-2024 Yifei Liu
+ * Copyright (c) 2020-2024 Wei Su
+ * Copyright (c) 2020-2024 Erez Zadok
+ * Copyright (c) 2020-2024 Stony Brook University
+ * Copyright (c) 2020-2024 The Research Foundation of SUNY
+ *
+ * You can redistribute it and/or modify it under the terms of the Apache
+ * License, Version 2.0 (http://www.apache.org/licenses/LICENSE-2.0).
+ */
+
+#include "fileutil.h"
+#include "partition.h"
+#include <signal.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+
+enum partition_policy partition_policy = PARTITION_OFF;
+bool partition_pruned = false;
+uint64_t partition_claims = 0;
+uint64_t partition_prunes = 0;
+
+/*
+ * The shared memory object: the pids of the VTs using it, by VT id, then
+ * the set of claimed states.  The VTs of a run register their pids, so
+ * that the first VT of the next run finds no live VT in the object and
+ * starts from an empty set.
+ */
+struct partition_shm {
+    uint64_t nslots;
+    int32_t pids[PARTITION_MAX_VTS + 1];
+    uint64_t slots[];
+};
+
+static struct partition_shm *shm = MAP_FAILED;
+static uint64_t *slots;
+static uint64_t nslots = PARTITION_DEFAULT_SLOTS;
+static size_t shm_size;
+static int nvts;
+static int my_vt;
+static size_t min_depth = PARTITION_DEFAULT_DEPTH;
+
+static uint64_t fingerprint(absfs_state_t *states)
+{
+    /* FNV-1a, as in set.cpp, followed by the splitmix64 finalizer so that
+     * the prefix bits used for ownership are well mixed */
+    const unsigned char *data = (const unsigned char *)states;
+    size_t len = get_n_fs() * sizeof(absfs_state_t);
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= data[i];
+        h *= 0x00000100000001B3ULL;
+    }
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+    return h ^ (h >> 31);
+}
+
+/* VT (1..nvts) that owns the state, given by the top 32 bits */
+static int owner_of(uint64_t fp)
+{
+    return (int)(((fp >> 32) * (uint64_t)nvts) >> 32) + 1;
+}
+
+/*
+ * Claim the state for this VT unless some VT already has, and return the
+ * id of the VT holding the claim.  The set is open-addressed with linear
+ * probing; slots are only ever filled, so a compare-and-swap on an empty
+ * slot is enough.  If no slot is found within PARTITION_MAX_PROBES, the
+ * state is treated as claimed by this VT (it is then never deduplicated).
+ */
+static int claim_state(uint64_t fp)
+{
+    uint64_t key = fp & ~(uint64_t)PARTITION_MAX_VTS;
+    if (key == 0)
+        key = (uint64_t)1 << PARTITION_VT_BITS;
+    uint64_t mine = key | my_vt;
+    uint64_t idx = fp % nslots;
+    for (int i = 0; i < PARTITION_MAX_PROBES; ++i) {
+        uint64_t *slot = &slots[(idx + i) % nslots];
+        uint64_t cur = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+        if (cur == 0) {
+            if (__atomic_compare_exchange_n(slot, &cur, mine, false,
+                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                partition_claims++;
+                return my_vt;
+            }
+            /* Lost the race; cur now holds the winner */
+        }
+        if ((cur & ~(uint64_t)PARTITION_MAX_VTS) == key)
+            return (int)(cur & PARTITION_MAX_VTS);
+    }
+    return my_vt;
+}
+
+static bool pid_alive(pid_t pid)
+{
+    return pid > 0 && (kill(pid, 0) == 0 || errno == EPERM);
+}
+
+/* Whether a VT other than this one is still using the object */
+static bool shm_in_use(const struct partition_shm *p)
+{
+    for (int vt = 1; vt <= PARTITION_MAX_VTS; ++vt) {
+        if (vt != my_vt && pid_alive(p->pids[vt]))
+            return true;
+    }
+    return false;
+}
+
+/*
+ * Map the shared object, and reset it if no VT of the current run uses it
+ * (it was left by an earlier run).  The VTs start together, so this is
+ * done under an exclusive lock of the object.
+ */
+static void map_shm(const char *name)
+{
+    int fd = shm_open(name, O_CREAT | O_RDWR, 0600);
+    if (fd < 0) {
+        logerr("Cannot open shared memory %s", name);
+        exit(1);
+    }
+    if (flock(fd, LOCK_EX) != 0) {
+        logerr("Cannot lock shared memory %s", name);
+        exit(1);
+    }
+
+    struct stat st;
+    bool stale = true;
+    if (fstat(fd, &st) != 0) {
+        logerr("Cannot stat shared memory %s", name);
+        exit(1);
+    }
+    if ((size_t)st.st_size >= sizeof(struct partition_shm)) {
+        struct partition_shm *old = mmap(NULL, st.st_size, PROT_READ,
+                                         MAP_SHARED, fd, 0);
+        if (old == MAP_FAILED) {
+            logerr("Cannot map shared memory %s", name);
+            exit(1);
+        }
+        stale = !shm_in_use(old);
+        munmap(old, st.st_size);
+    }
+    if (!stale && (size_t)st.st_size != shm_size) {
+        logerr("Shared memory %s has %zu bytes, not %zu; set the same "
+               PARTITION_SLOTS_ENV " for all VTs", name, (size_t)st.st_size,
+               shm_size);
+        exit(1);
+    }
+    /* Truncating to zero first drops the claims of the earlier run */
+    if (stale && (ftruncate(fd, 0) != 0 || ftruncate(fd, shm_size) != 0)) {
+        logerr("Cannot size shared memory %s", name);
+        exit(1);
+    }
+
+    shm = mmap(NULL, shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (shm == MAP_FAILED) {
+        logerr("Cannot map shared memory %s", name);
+        exit(1);
+    }
+    if (stale)
+        shm->nslots = nslots;
+    if (pid_alive(shm->pids[my_vt]) && shm->pids[my_vt] != getpid()) {
+        logerr("VT %d already runs as pid %d", my_vt, shm->pids[my_vt]);
+        exit(1);
+    }
+    shm->pids[my_vt] = getpid();
+    slots = shm->slots;
+    flock(fd, LOCK_UN);
+    close(fd);
+}
+
+void partition_init(int vt_id)
+{
+    const char *policy = getenv(PARTITION_ENV);
+    const char *vts = getenv(PARTITION_VTS_ENV);
+    const char *depth = getenv(PARTITION_DEPTH_ENV);
+    const char *nslots_str = getenv(PARTITION_SLOTS_ENV);
+    const char *name = getenv(PARTITION_SHM_ENV);
+
+    if (!policy)
+        return;
+    if (strcmp(policy, "claim") == 0) {
+        partition_policy = PARTITION_CLAIM;
+    } else if (strcmp(policy, "owner") == 0) {
+        partition_policy = PARTITION_OWNER;
+    } else {
+        logerr("Unknown " PARTITION_ENV " policy '%s' (claim or owner)",
+               policy);
+        exit(1);
+    }
+    nvts = vts ? atoi(vts) : 0;
+    if (nvts < 1 || nvts > PARTITION_MAX_VTS || vt_id < 1 || vt_id > nvts) {
+        logerr(PARTITION_ENV " needs " PARTITION_VTS_ENV " (1 to %d) and a "
+               "swarm id within it (got %d of %d)", PARTITION_MAX_VTS,
+               vt_id, nvts);
+        exit(1);
+    }
+    my_vt = vt_id;
+    if (depth)
+        min_depth = strtoul(depth, NULL, 10);
+    if (nslots_str && strtoull(nslots_str, NULL, 10) > 0)
+        nslots = strtoull(nslots_str, NULL, 10);
+    if (!name)
+        name = PARTITION_DEFAULT_SHM;
+
+    shm_size = sizeof(struct partition_shm) + nslots * sizeof(uint64_t);
+    map_shm(name);
+}
+
+void partition_destroy()
+{
+    if (shm == MAP_FAILED)
+        return;
+    /* The claims stay for the other VTs of the run */
+    __atomic_store_n(&shm->pids[my_vt], 0, __ATOMIC_RELEASE);
+    munmap(shm, shm_size);
+    shm = MAP_FAILED;
+    slots = NULL;
+}
+
+/*
+ * Called when SPIN stores a new state: decide whether this VT expands it.
+ * The decision is kept in partition_pruned, which the Promela worker
+ * checks before each of its statements.  A state is only pruned when the
+ * VT that claimed it expands it, since a VT cannot hand a state over to
+ * another one: the other VT would have to reach it on its own.
+ */
+void partition_visit(absfs_state_t *states, size_t depth)
+{
+    partition_pruned = false;
+    if (partition_policy == PARTITION_OFF || depth < min_depth)
+        return;
+    uint64_t fp = fingerprint(states);
+    int claimer = claim_state(fp);
+    /* The owner expands its states even if another VT got there first */
+    if (partition_policy == PARTITION_OWNER && owner_of(fp) == my_vt)
+        partition_pruned = false;
+    else
+        partition_pruned = (claimer != my_vt);
+    if (partition_pruned)
+        partition_prunes++;
+}
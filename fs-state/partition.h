@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2020-2024 Yifei Liu
+ * Copyright (c) 2020-2024 Wei Su
+ * Copyright (c) 2020-2024 Erez Zadok
+ * Copyright (c) 2020-2024 Stony Brook University
+ * Copyright (c) 2020-2024 The Research Foundation of SUNY
+ *
+ * You can redistribute it and/or modify it under the terms of the Apache
+ * License, Version 2.0 (http://www.apache.org/licenses/LICENSE-2.0).
+ */
+
+#ifndef _PARTITION_H_
+#define _PARTITION_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "abstract_fs.h"
+
+/*
+ * State-space partitioning across the swarm VTs of one machine.  Every
+ * abstract state is fingerprinted, and the VTs share a lock-free set of
+ * fingerprints in POSIX shared memory.  Each slot also records the VT that
+ * claimed the state first.  A VT stops expanding a state (the worker leaves
+ * its loop, so SPIN backtracks) when another VT has already claimed it, and
+ * so expands it.  With the owner policy, the prefix of the fingerprint also
+ * assigns every state to a VT, which expands it even if another VT claimed
+ * it first.  A state is never dropped only because another VT owns it: that
+ * VT may never reach it.
+ *
+ * States shallower than MCFS_PARTITION_DEPTH are never pruned, so that
+ * every VT gets past the initial states shared by all of them.  The set is
+ * reset when the first VT of a run finds no live VT registered in it.
+ */
+#define PARTITION_ENV "MCFS_PARTITION"
+/* Number of VTs sharing the set; VT ids are the swarm ids 1..N */
+#define PARTITION_VTS_ENV "MCFS_PARTITION_VTS"
+#define PARTITION_DEPTH_ENV "MCFS_PARTITION_DEPTH"
+#define PARTITION_SLOTS_ENV "MCFS_PARTITION_SLOTS"
+#define PARTITION_SHM_ENV "MCFS_PARTITION_SHM"
+
+#define PARTITION_DEFAULT_DEPTH 2
+#define PARTITION_DEFAULT_SLOTS (1UL << 22)
+#define PARTITION_DEFAULT_SHM "/mcfs-partition"
+/* Longest probe sequence before the set is treated as full */
+#define PARTITION_MAX_PROBES 64
+/* The low bits of a slot hold the id of the VT that claimed it */
+#define PARTITION_VT_BITS 8
+#define PARTITION_MAX_VTS ((1 << PARTITION_VT_BITS) - 1)
+
+enum partition_policy {
+    PARTITION_OFF = 0,
+    PARTITION_CLAIM,
+    PARTITION_OWNER,
+};
+
+extern enum partition_policy partition_policy;
+/* Set when the current state is left to another VT */
+extern bool partition_pruned;
+/* Totals reported in the perf CSV */
+extern uint64_t partition_claims;
+extern uint64_t partition_prunes;
+
+void partition_init(int vt_id);
+void partition_destroy();
+void partition_visit(absfs_state_t *states, size_t depth);
+
+#endif // _PARTITION_H_
@@ -11,9 +11,11 @@
 
 #include "fileutil.h"
 #include "swapperf.h"
+#include "cr.h"
 #include <sys/vfs.h>
 #include <sys/sysinfo.h>
 #include <pthread.h>
+#include <inttypes.h>
 
 static FILE *perflog_fp;
 static int curpid;
@@ -112,13 +114,30 @@ static int get_fs_stat(const char *mp, struct fs_stat *st)
     return ret;
 }
 
+static void get_verifs_pool_stat(const char *mp, struct fs_stat *st)
+{
+    struct verifs_pool_stat pool = {0};
+    int fd = open(mp, O_RDONLY | __O_DIRECTORY);
+    if (fd < 0)
+        return;
+    /* Leave the pool empty if the file system cannot report it */
+    if (ioctl(fd, VERIFS_POOL_STAT, &pool) == 0) {
+        st->pool_states = pool.nstates;
+        st->pool_bytes = pool.nbytes;
+    }
+    close(fd);
+}
+
 static pthread_mutex_t fsinfo_lock;
 
 void record_fs_stat()
 {
     struct fs_stat my_fsstats[get_n_fs()];
+    memset(my_fsstats, 0, sizeof(my_fsstats));
     for (int i = 0; i < get_n_fs(); ++i) {
         get_fs_stat(get_basepaths()[i], &my_fsstats[i]);
+        if (is_verifs(get_fslist()[i]))
+            get_verifs_pool_stat(verifs_ioctl_path(i), &my_fsstats[i]);
     }
     pthread_mutex_lock(&fsinfo_lock);
     memcpy(fsinfos, my_fsstats, sizeof(struct fs_stat) * get_n_fs());
@@ -128,6 +147,8 @@ void record_fs_stat()
 void record_performance()
 {
     static bool inited = false;
+    /* dedup_mode is cleared if the coordinator goes away */
+    static bool dedup_cols = false;
     static size_t last_count = 0;
     static struct timespec last_ts = {0};
     static struct iostat *last_swaps_stat;
@@ -143,7 +164,7 @@ void record_performance()
                 "minor_flt,major_flt,utime,ktime,num_threads,vmem_sz,pmem_sz,");
         /* metrics of the swap devices activity */
         n_swaps = num_swap_devices();
-        last_swaps_stat = malloc(n_swaps * sizeof(struct iostat));
+        last_swaps_stat = myheap_malloc(n_swaps * sizeof(struct iostat));
         assert(last_swaps_stat);
         get_swapstats(last_swaps_stat);
         if(n_swaps > 0)
@@ -157,7 +178,19 @@ void record_performance()
             const char *mp = get_fslist()[i];
             fprintf(perflog_fp, "%s_capacity,%s_free,%s_inodes,%s_ifree,",
                     mp, mp, mp, mp);
+            if (is_verifs(mp))
+                fprintf(perflog_fp, "%s_pool_states,%s_pool_bytes,", mp, mp);
         }
+        /* metrics of novelty-driven input selection */
+        if (novelty_mode)
+            fprintf(perflog_fp, "novelty_picks,novelty_hits,");
+        /* metrics of state-space partitioning across VTs */
+        if (partition_policy != PARTITION_OFF)
+            fprintf(perflog_fp, "partition_claims,partition_prunes,");
+        /* metrics of the global dedup coordinator */
+        dedup_cols = dedup_mode;
+        if (dedup_cols)
+            fprintf(perflog_fp, "dedup_sent,dedup_global_new,dedup_global_total,");
         fprintf(perflog_fp, "\n");
         inited = true;
     }
@@ -190,7 +223,7 @@ void record_performance()
             exit(1);
         }
         fprintf(perflog_fp, "%lu,", info.totalswap - info.freeswap);
-        swaps_stat = malloc(2 * n_swaps * sizeof(struct iostat));
+        swaps_stat = myheap_malloc(2 * n_swaps * sizeof(struct iostat));
         swaps_diff = swaps_stat + n_swaps;
         get_swapstats(swaps_stat);
         iostat_diff(swaps_diff, swaps_stat, last_swaps_stat);
@@ -202,7 +235,7 @@ void record_performance()
         /* Free last_swaps_stat[i].devname to avoid memory leak */
         put_swapstats(last_swaps_stat);
         memcpy(last_swaps_stat, swaps_stat, n_swaps * sizeof(struct iostat));
-        free(swaps_stat);
+        myheap_free(swaps_stat);
     }
     /* Iterate each file system */
     struct fs_stat cur_fsstats[get_n_fs()];
@@ -213,7 +246,18 @@ void record_performance()
         struct fs_stat *fs = cur_fsstats + i;
         fprintf(perflog_fp, "%zu,%zu,%zu,%zu,", fs->capacity, fs->bytes_free,
                 fs->total_inodes, fs->free_inodes);
+        if (is_verifs(get_fslist()[i]))
+            fprintf(perflog_fp, "%zu,%zu,", fs->pool_states, fs->pool_bytes);
     }
+    if (novelty_mode)
+        fprintf(perflog_fp, "%" PRIu64 ",%" PRIu64 ",", novelty_picks,
+                novelty_hits);
+    if (partition_policy != PARTITION_OFF)
+        fprintf(perflog_fp, "%" PRIu64 ",%" PRIu64 ",", partition_claims,
+                partition_prunes);
+    if (dedup_cols)
+        fprintf(perflog_fp, "%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",", dedup_sent,
+                dedup_global_new, dedup_global_total);
     fprintf(perflog_fp, "\n");
     fflush(perflog_fp);
     /*
@@ -245,21 +289,6 @@ void start_perf_metrics_thread()
     pthread_mutex_init(&fsinfo_lock, NULL);
 }
 
-void seed_rand_with_urandom()
-{
-    int randfd = open("/dev/urandom", O_RDONLY);
-    /* Will fall back to timestamp if the rand device is not available */
-    unsigned seed = time(0);
-    if (randfd < 0) {
-        fprintf(stderr, "Failed to open /dev/urandom: %d. Will use timestamp "
-                "to seed rand() RNG instead.\n", errno);
-    } else {
-        read(randfd, &seed, sizeof(unsigned));
-        close(randfd);
-    }
-    srand(seed);
-}
-
 static void __attribute__((constructor)) perf_init()
 {
     char perf_log_name[NAME_MAX] = {0};
@@ -270,10 +299,14 @@ static void __attribute__((constructor)) perf_init()
                 errnoname(-progname_len), progname_len);
         exit(1);
     }
-    seed_rand_with_urandom();
+    mcfs_prng_init();
     get_swaps();
     current_utc_time(&begin_time);
-    add_ts_to_logname(perf_log_name, NAME_MAX, PERF_PREFIX, progname, ".csv");
+    if (getenv(PERF_CSV_ENV))
+        snprintf(perf_log_name, NAME_MAX, "%s", getenv(PERF_CSV_ENV));
+    else
+        add_ts_to_logname(perf_log_name, NAME_MAX, PERF_PREFIX, progname,
+                          ".csv");
     perflog_fp = fopen(perf_log_name, "w");
     if (!perflog_fp) {
         fprintf(stderr, "Cannot create or open perf log file at %s (%d)\n",
@@ -11,12 +11,13 @@
  */
 
 #include "replayutil.h"
+#include "arena.h"
 
 int pre = 0;
 int seq = 0;
 
 #if ENABLE_REPLAYER_CR
-vector_t states;
+struct fs_state_stack states;
 #endif
 /* 
  * NOTE: NEED TO RECOMPILE REPLAYER "make replayer" every time we run it.
@@ -60,8 +61,13 @@ int main(int argc, char **argv)
 	ssize_t len, pre_len;
 	size_t linecap = 0, pre_linecap = 0;
 	char *linebuf = NULL, *pre_linebuf = NULL;
+	/* Scratch space of one line of the pre-population file */
+	struct arena line_arena = {0};
+	/* Records of the parsed ops, put back once they are replayed */
+	struct pool op_pool;
+	pool_init(&op_pool, sizeof(struct replay_op), 0);
 #if ENABLE_REPLAYER_CR
-	replayer_init(states);
+	replayer_init(&states);
 #endif
 	/* Populate mount points and mkfs the devices */
 	setup_filesystems();
@@ -69,20 +75,19 @@ int main(int argc, char **argv)
 	mountall();
 	
 	while ((pre_len = getline(&pre_linebuf, &pre_linecap, pre_fp)) >= 0) {
-		char *line = malloc(pre_len + 1);
-		line[pre_len] = '\0';
-		strncpy(line, pre_linebuf, pre_len);
+		char *line = arena_strndup(&line_arena, pre_linebuf, pre_len);
 		/* remove the newline character */
 		if (line[pre_len - 1] == '\n')
 			line[pre_len - 1] = '\0';
 		printf("pre=%d \n", pre);
 		/* parse the line for pre-populated files and directories */
-		size_t pre_path_len;
-		char *pre_path_name;
+		char pre_path_name[PATH_MAX];
 		for (int i = 0; i < get_n_fs(); ++i) {
-			pre_path_len = snprintf(NULL, 0, "%s%s", get_basepaths()[i], line);
-			pre_path_name = calloc(1, pre_path_len + 1);
-			snprintf(pre_path_name, pre_path_len + 1, "%s%s", get_basepaths()[i], line);
+			if (tc_path_joinall(pre_path_name, PATH_MAX,
+					    get_basepaths()[i], line) < 0) {
+				fprintf(stderr, "pre-populated path is too long!\n");
+				exit(EXIT_FAILURE);
+			}
 			// printf("pre_path_name=%s\n", pre_path_name);
 			int ret = -1;
 			ret = mkdir_p(pre_path_name, 0755, 0644);
@@ -90,91 +95,59 @@ int main(int argc, char **argv)
 				fprintf(stderr, "mkdir_p error happened!\n");
 				exit(EXIT_FAILURE);
 			}
-			free(pre_path_name);
 		}
+		arena_reset(&line_arena);
 		pre++;
 	}
+	arena_destroy(&line_arena);
 	unmount_all_strict();
 	/* Replay the actual operation sequence */
 	while ((len = getline(&linebuf, &linecap, seqfp)) >= 0) {
-		char *line = malloc(len + 1);
-		line[len] = '\0';
-		strncpy(line, linebuf, len);
-		/* remove the newline character */
-		if (line[len - 1] == '\n')
-			line[len - 1] = '\0';
 		printf("seq=%d \n", seq);
-		/* parse the line */
-		vector_t argvec;
-		extract_fields(&argvec, line, ", ");
-		char *funcname = *vector_get(&argvec, char *, 0);
+		/* parse the line in place */
+		struct replay_op *op = pool_get(&op_pool);
+		if (!op) {
+			fprintf(stderr, "Cannot allocate the op of line %d\n", seq);
+			exit(EXIT_FAILURE);
+		}
+		int err = parse_replay_line(linebuf, op);
 #if ENABLE_REPLAYER_CR		
 		bool flag_ckpt = false, flag_restore = false;
 #endif
 		mountall();
 	  
-		if (strncmp(funcname, "create_file", len) == 0) {
-			do_create_file(&argvec);
-		} else if (strncmp(funcname, "write_file", len) == 0) {
-			do_write_file(&argvec, seq);
-		} else if (strncmp(funcname, "truncate", len) == 0) {
-			do_truncate(&argvec);
-		} else if (strncmp(funcname, "unlink", len) == 0) {
-			do_unlink(&argvec);
-		} else if (strncmp(funcname, "mkdir", len) == 0) {
-			do_mkdir(&argvec);
-		} else if (strncmp(funcname, "rmdir", len) == 0) {
-			do_rmdir(&argvec);
-		} else if (strncmp(funcname, "rename", len) == 0) {
-			do_rename(&argvec);
-		} else if (strncmp(funcname, "symlink", len) == 0) {
-			do_symlink(&argvec);
-		} else if (strncmp(funcname, "link", len) == 0) {
-			do_link(&argvec);
-		} else if (strncmp(funcname, "unlink", len) == 0) {
-            		do_unlink(&argvec);
-        	} else if (strncmp(funcname, "chmod", len) == 0) {
-			do_chmod(&argvec);
-		} else if (strncmp(funcname, "chgrp_file", len) == 0) {
-			do_chgrp(&argvec);
-		} else if (strncmp(funcname, "chown_file", len) == 0) {
-			do_chown(&argvec);
-		} else if (strncmp(funcname, "removexattr", len) == 0) {
-			do_removexattr(&argvec);
-		} else if (strncmp(funcname, "setxattr", len) == 0) {
-			do_setxattr(&argvec);
-		} else if (strncmp(funcname, "checkpoint", len) == 0) {
+		if (err != 0) {
+			printf("Unrecognized op: %s\n", op->name ? op->name : "");
+		} else if (op->code == OP_CHECKPOINT) {
 #if ENABLE_REPLAYER_CR			
 			flag_ckpt = true;
-			seq--;
-#else
-			seq--;
 #endif
-		} else if (strncmp(funcname, "restore", len) == 0) {
+			seq--;
+		} else if (op->code == OP_RESTORE) {
 #if ENABLE_REPLAYER_CR
 			flag_restore = true;
-			seq--;
-#else
-			seq--;
 #endif
+			seq--;
 		} else {
-			printf("Unrecognized op: %s\n", funcname);
+			exec_replay_op(op, seq);
+			if (!is_replay_fsop(op))
+				seq--;
 		}
+		pool_put(&op_pool, op);
 		seq++;
 		unmount_all_strict();
 #if ENABLE_REPLAYER_CR
 		if (flag_ckpt)
-			checkpoint(seq, states);
+			checkpoint(seq, &states);
 		if (flag_restore)
-			restore(states);
+			restore(&states);
 #endif
 		errno = 0;
-		free(line);
-		destroy_fields(&argvec);
 	}
 	/* Clean up */
 	fclose(pre_fp);
 	fclose(seqfp);
+	pool_destroy(&op_pool);
 	free(pre_linebuf);
 	free(linebuf);
 
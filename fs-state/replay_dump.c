@@ -18,7 +18,7 @@
 
 int seq = 0;
 
-vector_t states;
+struct fs_state_stack states;
 
 /* Replayer dump device utilities */
 static size_t state_depth = 0;
@@ -126,52 +126,35 @@ int main(int argc, char **argv)
 		printf("Cannot open sequence.log. Does it exist?\n");
 		exit(1);
 	}
-	replayer_init(states);
+	replayer_init(&states);
 	setup_filesystems();
 	while ((len = getline(&linebuf, &linecap, seqfp)) >= 0) {
-		char *line = malloc(len + 1);
-		line[len] = '\0';
-		strncpy(line, linebuf, len);
-		/* remove the newline character */
-		if (line[len - 1] == '\n')
-			line[len - 1] = '\0';
 		printf("seq=%d ", seq);
-		/* parse the line */
-		vector_t argvec;
-		extract_fields(&argvec, line, ", ");
-		char *funcname = *vector_get(&argvec, char *, 0);
+		/* parse the line in place */
+		struct replay_op op;
+		int err = parse_replay_line(linebuf, &op);
 		bool flag_ckpt = false, flag_restore = false;
 		mountall();
-		if (strncmp(funcname, "create_file", len) == 0) {
-			do_create_file(&argvec);
-		} else if (strncmp(funcname, "write_file", len) == 0) {
-			do_write_file(&argvec, seq);
-		} else if (strncmp(funcname, "truncate", len) == 0) {
-			do_truncate(&argvec);
-		} else if (strncmp(funcname, "unlink", len) == 0) {
-			do_unlink(&argvec);
-		} else if (strncmp(funcname, "mkdir", len) == 0) {
-			do_mkdir(&argvec);
-		} else if (strncmp(funcname, "rmdir", len) == 0) {
-			do_rmdir(&argvec);
-		} else if (strncmp(funcname, "checkpoint", len) == 0) {
+		if (err != 0) {
+			printf("Unrecognized op: %s\n", op.name ? op.name : "");
+		} else if (op.code == OP_CHECKPOINT) {
 			flag_ckpt = true;
 			seq--;
-		} else if (strncmp(funcname, "restore", len) == 0) {
+		} else if (op.code == OP_RESTORE) {
 			flag_restore = true;
 			seq--;
 		} else {
-			printf("Unrecognized op: %s\n", funcname);
+			exec_replay_op(&op, seq);
+			if (!is_replay_fsop(&op))
+				seq--;
 		}
 		seq++;
 		unmount_all_strict();
 		if (flag_ckpt)
-			checkpoint(seq, states);
+			checkpoint(seq, &states);
 		if (flag_restore)
-			restore(states);
+			restore(&states);
 		errno = 0;
-		free(line);
-		destroy_fields(&argvec);
 	}
 	fclose(seqfp);
 	free(linebuf);
@@ -11,234 +11,370 @@
 
 #include "replayutil.h"
 
-void extract_fields(vector_t *fields_vec, char *line, const char *delim)
+/*
+ * How the arguments of each operation in sequence.log are converted, one
+ * character per field after the name:
+ *   p: path, q: second path or xattr name, v: xattr value, f: flags,
+ *   m: mode, b: byte, o: offset or length, s: size, n: number (uid, gid or
+ *   seed), x: ignored (e.g., the data pointer of write_file)
+ * Numbers are parsed with base 0, which matches how the driver logs them
+ * (decimal for "%d", octal for "0%o").
+ */
+struct replay_op_desc {
+	const char *name;
+	enum replay_opcode code;
+	const char *args;
+};
+
+static const struct replay_op_desc replay_ops[] = {
+	{"create_file", OP_CREATE_FILE, "pfm"},
+	{"write_file", OP_WRITE_FILE, "pfxos"},
+	{"write_file_byte", OP_WRITE_FILE_BYTE, "pfbos"},
+	{"truncate", OP_TRUNCATE, "po"},
+	{"unlink", OP_UNLINK, "p"},
+	{"mkdir", OP_MKDIR, "pm"},
+	{"rmdir", OP_RMDIR, "p"},
+	{"rename", OP_RENAME, "pq"},
+	{"symlink", OP_SYMLINK, "pq"},
+	{"link", OP_LINK, "pq"},
+	{"chmod", OP_CHMOD, "pm"},
+	{"chown_file", OP_CHOWN, "pn"},
+	{"chgrp_file", OP_CHGRP, "pn"},
+	{"setxattr", OP_SETXATTR, "pqvsf"},
+	{"removexattr", OP_REMOVEXATTR, "pq"},
+	{"checkpoint", OP_CHECKPOINT, ""},
+	{"restore", OP_RESTORE, ""},
+	{"seed", OP_SEED, "n"},
+};
+
+#define N_REPLAY_OPS (sizeof(replay_ops) / sizeof(replay_ops[0]))
+/* Power of two, comfortably larger than N_REPLAY_OPS */
+#define REPLAY_OP_TABLE_SIZE 64
+
+/* Perfect hash of the op names: a seeded FNV-1a, with the seed searched
+ * once so that no two names share a slot */
+static const struct replay_op_desc *replay_op_table[REPLAY_OP_TABLE_SIZE];
+static uint32_t replay_op_seed;
+static bool replay_op_table_ready = false;
+
+static uint32_t replay_op_hash(slice_t name, uint32_t seed)
+{
+	uint32_t h = 2166136261u ^ seed;
+	for (size_t i = 0; i < name.size; ++i) {
+		h ^= (unsigned char)name.data[i];
+		h *= 16777619u;
+	}
+	return h & (REPLAY_OP_TABLE_SIZE - 1);
+}
+
+static void build_replay_op_table()
+{
+	for (uint32_t seed = 0; ; ++seed) {
+		bool collision = false;
+		memset(replay_op_table, 0, sizeof(replay_op_table));
+		for (size_t i = 0; i < N_REPLAY_OPS && !collision; ++i) {
+			uint32_t h = replay_op_hash(toslice(replay_ops[i].name), seed);
+			if (replay_op_table[h])
+				collision = true;
+			else
+				replay_op_table[h] = &replay_ops[i];
+		}
+		if (!collision) {
+			replay_op_seed = seed;
+			break;
+		}
+	}
+	replay_op_table_ready = true;
+}
+
+static const struct replay_op_desc *lookup_replay_op(slice_t name)
+{
+	if (!replay_op_table_ready)
+		build_replay_op_table();
+	const struct replay_op_desc *desc =
+		replay_op_table[replay_op_hash(name, replay_op_seed)];
+	if (desc && cmpslice(name, toslice(desc->name)) == 0)
+		return desc;
+	return NULL;
+}
+
+/*
+ * Split the line in place: runs of ',' and ' ' separate the fields, and
+ * are overwritten with NULs so that every field is also a C string.
+ * Returns the number of fields.
+ */
+static int tokenize_replay_line(char *line, slice_t *fields, int maxfields)
 {
-	vector_init(fields_vec, char *);
-	char *field = strtok(line, delim);
-	while (field) {
-		size_t flen = strlen(field);
-		char *field_copy = malloc(flen + 1);
-		assert(field_copy);
-		field_copy[flen] = '\0';
-		strncpy(field_copy, field, flen);
-		vector_add(fields_vec, &field_copy);
-		field = strtok(NULL, ", ");
+	int n = 0;
+	char *p = line;
+
+	while (*p) {
+		while (*p == ',' || *p == ' ')
+			*p++ = '\0';
+		if (!*p)
+			break;
+		char *begin = p;
+		while (*p && *p != ',' && *p != ' ')
+			++p;
+		if (n < maxfields)
+			fields[n] = mkslice(begin, p - begin);
+		++n;
 	}
+	return n;
 }
 
-void destroy_fields(vector_t *fields_vec)
+int parse_replay_line(char *line, struct replay_op *op)
 {
-	char **field;
-	vector_iter(fields_vec, char *, field) {
-		free(*field);
+	slice_t fields[REPLAY_MAX_FIELDS];
+	int nfields;
+	const struct replay_op_desc *desc;
+
+	memset(op, 0, sizeof(*op));
+	/* Remove the newline character */
+	size_t len = strlen(line);
+	if (len > 0 && line[len - 1] == '\n')
+		line[len - 1] = '\0';
+	nfields = tokenize_replay_line(line, fields, REPLAY_MAX_FIELDS);
+	if (nfields == 0)
+		return -EINVAL;
+	op->name = fields[0].data;
+	desc = lookup_replay_op(fields[0]);
+	if (!desc)
+		return -ENOENT;
+	op->code = desc->code;
+	if (nfields < 1 + (int)strlen(desc->args))
+		return -EINVAL;
+
+	for (int i = 0; desc->args[i]; ++i) {
+		const char *arg = fields[i + 1].data;
+		switch (desc->args[i]) {
+		case 'p':
+			op->path = arg;
+			break;
+		case 'q':
+			op->path2 = arg;
+			break;
+		case 'v':
+			op->value = arg;
+			break;
+		case 'f':
+			op->flags = (int)strtol(arg, NULL, 0);
+			break;
+		case 'm':
+			op->mode = (mode_t)strtol(arg, NULL, 0);
+			break;
+		case 'b':
+			op->byte = (int)strtol(arg, NULL, 0);
+			break;
+		case 'o':
+			op->offset = strtoll(arg, NULL, 0);
+			break;
+		case 's':
+			op->size = strtoull(arg, NULL, 0);
+			break;
+		case 'n':
+			op->num = strtoull(arg, NULL, 0);
+			break;
+		default:
+			break;
+		}
 	}
-	vector_destroy(fields_vec);
+	return 0;
 }
 
-int do_create_file(vector_t *argvec)
+static int do_create_file(const struct replay_op *op, int seq)
 {
-	char *filepath = *vector_get(argvec, char *, 1);
-	char *flagstr = *vector_get(argvec, char *, 2);
-	char *modestr = *vector_get(argvec, char *, 3);
-	char *endptr;
-	int flags = (int)strtol(flagstr, &endptr, 8);
-	int mode = (int)strtol(modestr, &endptr, 8);
-	int res = create_file(filepath, flags, mode);
+	int res = create_file(op->path, op->flags, op->mode);
 	printf("create_file(%s, 0%o, 0%o) -> ret=%d, errno=%s\n",
-	       filepath, flags, mode, res, errnoname(errno));
+	       op->path, op->flags, op->mode, res, errnoname(errno));
 	return res;
 }
 
-int do_write_file(vector_t *argvec, int seq)
+static int do_write_file(const struct replay_op *op, int seq)
 {
-	char *filepath = *vector_get(argvec, char *, 1);
-	char *flagstr = *vector_get(argvec, char *, 2);
-	char *offset_str = *vector_get(argvec, char *, 4);
-	char *len_str = *vector_get(argvec, char *, 5);
-	char *endp;
-	int flags = (int)strtol(flagstr, &endp, 8);
-	off_t offset = strtol(offset_str, &endp, 10);
-	size_t writelen = strtoul(len_str, &endp, 10);
-	assert(offset != LONG_MAX);
-	assert(writelen != ULONG_MAX);
-	
-	char *buffer = malloc(writelen);
-	assert(buffer != NULL);
 	/* This is to make sure data written to all file systems in the same
 	 * group of operations is the same */
 	int integer_to_write = seq / get_n_fs();
-	generate_data(buffer, writelen, offset, BYTE_REPEAT, integer_to_write);
-	int ret = write_file(filepath, flags, buffer, offset, writelen);
+	int ret = write_file_byte(op->path, op->flags, integer_to_write,
+				  op->offset, op->size);
 	int err = errno;
 	printf("write_file(%s, %o, %ld, %lu) -> ret=%d, errno=%s\n",
-	       filepath, flags, offset, writelen, ret, errnoname(err));
-	free(buffer);
+	       op->path, op->flags, op->offset, op->size, ret, errnoname(err));
 	return ret;
 }
 
-int do_truncate(vector_t *argvec)
+/* write_file_byte logs the byte it wrote, so the same data is written */
+static int do_write_file_byte(const struct replay_op *op, int seq)
 {
-	char *filepath = *vector_get(argvec, char *, 1);
-	char *len_str = *vector_get(argvec, char *, 2);
-	off_t flen = atol(len_str);
-	
-	int ret = truncate(filepath, flen);
+	int ret = write_file_byte(op->path, op->flags, op->byte, op->offset,
+				  op->size);
+	int err = errno;
+	printf("write_file_byte(%s, %o, %d, %ld, %lu) -> ret=%d, errno=%s\n",
+	       op->path, op->flags, op->byte, op->offset, op->size, ret,
+	       errnoname(err));
+	return ret;
+}
+
+static int do_truncate(const struct replay_op *op, int seq)
+{
+	int ret = truncate(op->path, op->offset);
 	int err = errno;
 	printf("truncate(%s, %ld) -> ret=%d, errno=%s\n",
-	       filepath, flen, ret, errnoname(err));
+	       op->path, op->offset, ret, errnoname(err));
 	return ret;
 }
 
-int do_unlink(vector_t *argvec)
+static int do_unlink(const struct replay_op *op, int seq)
 {
-	char *path = *vector_get(argvec, char *, 1);
-	int ret = unlink(path);
+	int ret = unlink(op->path);
 	int err = errno;
 	printf("unlink(%s) -> ret=%d, errno=%s\n",
-	       path, ret, errnoname(err));
+	       op->path, ret, errnoname(err));
 	return ret;
 }
 
-int do_mkdir(vector_t *argvec)
+static int do_mkdir(const struct replay_op *op, int seq)
 {
-	char *path = *vector_get(argvec, char *, 1);
-	char *modestr = *vector_get(argvec, char *, 2);
-	char *endp;
-	int mode = (int)strtol(modestr, &endp, 8);
-	int ret = mkdir(path, mode);
+	int ret = mkdir(op->path, op->mode);
 	int err = errno;
 	printf("mkdir(%s, 0%o) -> ret=%d, errno=%s\n",
-	       path, mode, ret, errnoname(err));
+	       op->path, op->mode, ret, errnoname(err));
 	return ret;
 }
 
-int do_rmdir(vector_t *argvec)
+static int do_rmdir(const struct replay_op *op, int seq)
 {
-	char *path = *vector_get(argvec, char *, 1);
-	int ret = rmdir(path);
+	int ret = rmdir(op->path);
 	int err = errno;
 	printf("rmdir(%s) -> ret=%d, errno=%s\n",
-	       path, ret, errnoname(err));
+	       op->path, ret, errnoname(err));
 	return ret;
 }
-int do_rename(vector_t *argvec)
-{
-	char *srcpath = *vector_get(argvec, char *, 1);
-	char *dstpath = *vector_get(argvec, char *, 2);
 
-	int ret = rename(srcpath, dstpath);
+static int do_rename(const struct replay_op *op, int seq)
+{
+	int ret = rename(op->path, op->path2);
 	int err = errno;
 	printf("rename(%s, %s) -> ret=%d, errno=%s\n",
-	       srcpath, dstpath, ret, errnoname(err));
+	       op->path, op->path2, ret, errnoname(err));
 	return ret;
 }
-int do_symlink(vector_t *argvec)
-{
-	char *srcpath = *vector_get(argvec, char *, 1);
-	char *dstpath = *vector_get(argvec, char *, 2);
 
-	int ret = symlink(srcpath, dstpath);
+static int do_symlink(const struct replay_op *op, int seq)
+{
+	int ret = symlink(op->path, op->path2);
 	int err = errno;
 	printf("symlink(%s, %s) -> ret=%d, errno=%s\n",
-	       srcpath, dstpath, ret, errnoname(err));
+	       op->path, op->path2, ret, errnoname(err));
 	return ret;
 }
-int do_link(vector_t *argvec)
-{
-	char *srcpath = *vector_get(argvec, char *, 1);
-	char *dstpath = *vector_get(argvec, char *, 2);
 
-	int ret = link(srcpath, dstpath);
+static int do_link(const struct replay_op *op, int seq)
+{
+	int ret = link(op->path, op->path2);
 	int err = errno;
 	printf("link(%s, %s) -> ret=%d, errno=%s\n",
-	       srcpath, dstpath, ret, errnoname(err));
+	       op->path, op->path2, ret, errnoname(err));
 	return ret;
 }
 
-int do_setxattr(vector_t *argvec)
+static int do_setxattr(const struct replay_op *op, int seq)
 {
-    char *path = *vector_get(argvec, char *, 1);
-    char *attr_name = *vector_get(argvec, char *, 2);
-    char *attr_value = *vector_get(argvec, char *, 3);
-    char *size = *vector_get(argvec, char *, 4);
-    char *flag = *vector_get(argvec, char *, 5);
-
-    char *size_ptr, *flag_ptr;
-    size_t attr_size = strtoul(size, &size_ptr, 10);
-    int flag_val = (int) strtol(flag, &flag_ptr, 0);
-
-    int ret = setxattr(path, attr_name, attr_value, attr_size, flag_val);
-    int err = errno;
-
-    printf("setxattr(%s, %s, %s, %zu, %d) -> ret=%d, errno=%s\n",
-            path, attr_name, attr_value, attr_size, flag_val, ret, strerror(err));
-    
-    return ret;
+	int ret = setxattr(op->path, op->path2, op->value, op->size, op->flags);
+	int err = errno;
+	printf("setxattr(%s, %s, %s, %zu, %d) -> ret=%d, errno=%s\n",
+	       op->path, op->path2, op->value, op->size, op->flags, ret,
+	       strerror(err));
+	return ret;
 }
 
-int do_removexattr(vector_t *argvec)
+static int do_removexattr(const struct replay_op *op, int seq)
 {
-    char *path = *vector_get(argvec, char *, 1);
-    char *attr_name = *vector_get(argvec, char *, 2);
-
-    int ret = removexattr(path, attr_name);
-    int err = errno;
-
-    printf("removexattr(%s, %s) -> ret=%d, errno=%s\n",
-            path, attr_name, ret, strerror(err));
-    
-    return ret;   
+	int ret = removexattr(op->path, op->path2);
+	int err = errno;
+	printf("removexattr(%s, %s) -> ret=%d, errno=%s\n",
+	       op->path, op->path2, ret, strerror(err));
+	return ret;
 }
 
-int do_chown(vector_t *argvec)
+static int do_chown(const struct replay_op *op, int seq)
 {
-    char *path = *vector_get(argvec, char *, 1);
-    char *owner_name = *vector_get(argvec, char *, 2);
-
-    char *owner_str;
-    uid_t uid = strtoul(owner_name, &owner_str, 10);
-
-    int ret = chown(path, uid, -1);
-    int err = errno;
-
-    printf("chown(%s, %d) -> ret=%d, errno=%s\n",
-            path, (int) uid, ret, strerror(err));
-    
-    return ret;
+	int ret = chown(op->path, (uid_t)op->num, -1);
+	int err = errno;
+	printf("chown(%s, %d) -> ret=%d, errno=%s\n",
+	       op->path, (int)op->num, ret, strerror(err));
+	return ret;
 }
 
-int do_chgrp(vector_t *argvec)
+static int do_chgrp(const struct replay_op *op, int seq)
 {
-    char *path = *vector_get(argvec, char *, 1);
-    char *group_name = *vector_get(argvec, char *, 2);
-
-    char *group_str;
-    gid_t gid = strtoul(group_name, &group_str, 10);
-
-    int ret = chown(path, -1, gid);
-    int err = errno;
+	int ret = chown(op->path, -1, (gid_t)op->num);
+	int err = errno;
+	printf("chgrp(%s, %d) -> ret=%d, errno=%s\n",
+	       op->path, (int)op->num, ret, strerror(err));
+	return ret;
+}
 
-    printf("chgrp(%s, %d) -> ret=%d, errno=%s\n",
-            path, (int) gid, ret, strerror(err));
-    
-    return ret;   
+static int do_chmod(const struct replay_op *op, int seq)
+{
+	int ret = chmod(op->path, op->mode);
+	int err = errno;
+	printf("chmod(%s, 0%o) -> ret=%d, errno=%s\n",
+	       op->path, op->mode, ret, strerror(err));
+	return ret;
 }
 
-int do_chmod(vector_t *argvec)
+/*
+ * The driver records its PRNG seed at the top of the sequence log.
+ * Reseeding with it makes the random draws of the replayer start from
+ * the same point as the original run.
+ */
+static int do_seed(const struct replay_op *op, int seq)
 {
-    char *path = *vector_get(argvec, char *, 1);
-    char *mode_val = *vector_get(argvec, char *, 2);
+	mcfs_prng_seed(op->num);
+	printf("seed(%" PRIu64 ")\n", (uint64_t)op->num);
+	return 0;
+}
 
-    char *mode_str;
-    mode_t mode = strtol(mode_val, &mode_str, 8);
+static int (*const replay_handlers[NR_REPLAY_OPCODES])(const struct replay_op *, int) = {
+	[OP_CREATE_FILE] = do_create_file,
+	[OP_WRITE_FILE] = do_write_file,
+	[OP_WRITE_FILE_BYTE] = do_write_file_byte,
+	[OP_TRUNCATE] = do_truncate,
+	[OP_UNLINK] = do_unlink,
+	[OP_MKDIR] = do_mkdir,
+	[OP_RMDIR] = do_rmdir,
+	[OP_RENAME] = do_rename,
+	[OP_SYMLINK] = do_symlink,
+	[OP_LINK] = do_link,
+	[OP_CHMOD] = do_chmod,
+	[OP_CHOWN] = do_chown,
+	[OP_CHGRP] = do_chgrp,
+	[OP_SETXATTR] = do_setxattr,
+	[OP_REMOVEXATTR] = do_removexattr,
+	[OP_SEED] = do_seed,
+};
 
-    int ret = chmod(path, mode);
-    int err = errno;
+/*
+ * Run a parsed operation.  @seq is only used by legacy write_file lines,
+ * whose byte is derived from it.  Checkpoint and restore are left to the
+ * caller, and return -ENOTSUP here.
+ */
+int exec_replay_op(const struct replay_op *op, int seq)
+{
+	if (op->code <= OP_UNKNOWN || op->code >= NR_REPLAY_OPCODES ||
+	    !replay_handlers[op->code]) {
+		errno = ENOTSUP;
+		return -ENOTSUP;
+	}
+	return replay_handlers[op->code](op, seq);
+}
 
-    printf("chmod(%s, 0%o) -> ret=%d, errno=%s\n",
-            path, mode, ret, strerror(err));
-    
-    return ret;
+/* Whether the op is a file system operation (not a checkpoint etc.) */
+bool is_replay_fsop(const struct replay_op *op)
+{
+	return op->code != OP_UNKNOWN && op->code != OP_CHECKPOINT &&
+	       op->code != OP_RESTORE && op->code != OP_SEED;
 }
 
 void populate_replay_basepaths()
@@ -253,11 +389,11 @@ void populate_replay_basepaths()
 }
 
 /* Now I would expect the setup script to setup file systems instead. */
-void replayer_init(vector_t states)
+void replayer_init(struct fs_state_stack *states)
 {
-	srand(time(0));
+	mcfs_prng_init();
 	populate_replay_basepaths();
-	vector_init(&states, fs_state_t);
+	fs_state_stack_init(states);
 }
 
 static void do_checkpoint(const char *devpath, char **bufptr)
@@ -281,15 +417,15 @@ static void do_checkpoint(const char *devpath, char **bufptr)
 	close(devfd);
 }
 
-void checkpoint(int seq, vector_t states)
+void checkpoint(int seq, struct fs_state_stack *states)
 {
-	fs_state_t state;
-	state.seqid = seq;
-	state.images = calloc(get_n_fs(), sizeof(char *));
+	fs_state_t *state = fs_state_stack_emplace(states);
+	assert(state);
+	state->seqid = seq;
+	state->images = calloc(get_n_fs(), sizeof(char *));
 	for (int i = 0; i < get_n_fs(); ++i) {
-		do_checkpoint(get_devlist()[i], &state.images[i]);
+		do_checkpoint(get_devlist()[i], &state->images[i]);
 	}
-	vector_add(&states, &state);
 	printf("checkpoint\n");
 }
 
@@ -310,18 +446,17 @@ static void do_restore(const char *devpath, char *buffer)
 	close(devfd);
 }
 
-void restore(vector_t states)
+void restore(struct fs_state_stack *states)
 {
-	fs_state_t *state = vector_peek_top(&states, fs_state_t);
-	if (!state)
+	fs_state_t state;
+	if (!fs_state_stack_pop(states, &state))
 		return;
 	for (int i = 0; i < get_n_fs(); ++i) {
-		do_restore(get_devlist()[i], state->images[i]);
+		do_restore(get_devlist()[i], state.images[i]);
 	}
-	if (state->images)
-		free(state->images);
-	vector_pop_back(&states);
-	printf("restore (to the state just before seqid = %d)\n", state->seqid);
+	if (state.images)
+		free(state.images);
+	printf("restore (to the state just before seqid = %d)\n", state.seqid);
 }
 
 char *get_replayed_absfs(const char *basepath,
@@ -26,6 +26,7 @@
 #include <sys/mount.h>
 #include <sys/xattr.h>
 #include <limits.h>
+#include <inttypes.h>
 
 // This flag governs whether replayer uses Checkpoint/Restore (1) or not (0) during its execution
 // By default Checkpoint/Restore is disabled as it causes memory leak while replaying large sequence of operations
@@ -34,7 +35,8 @@
 #define __USE_XOPEN_EXTENDED 1
 #include <ftw.h>
 
-#include "vector.h"
+#include "stack.h"
+#include "common_types.h"
 
 #include "errnoname.h"
 #include "fileutil.h" // includes "abstract_fs.h"
@@ -47,26 +49,64 @@ typedef struct concrete_state {
 	char **images;
 } fs_state_t;
 
-void extract_fields(vector_t *fields_vec, char *line, const char *delim);
-void destroy_fields(vector_t *fields_vec);
-int do_create_file(vector_t *argvec);
-int do_write_file(vector_t *argvec, int seq);
-int do_truncate(vector_t *argvec);
-int do_unlink(vector_t *argvec);
-int do_mkdir(vector_t *argvec);
-int do_rmdir(vector_t *argvec);
-int do_rename(vector_t *argvec);
-int do_symlink(vector_t *argvec);
-int do_link(vector_t *argvec);
-int do_setxattr(vector_t *argvec);
-int do_removexattr(vector_t *argvec);
-int do_chown(vector_t *argvec);
-int do_chgrp(vector_t *argvec);
-int do_chmod(vector_t *argvec);
+/* Checkpoint stack of the replayer */
+DEFINE_STACK(fs_state_stack, fs_state_t)
+
+enum replay_opcode {
+	OP_UNKNOWN = 0,
+	OP_CREATE_FILE,
+	OP_WRITE_FILE,
+	OP_WRITE_FILE_BYTE,
+	OP_TRUNCATE,
+	OP_UNLINK,
+	OP_MKDIR,
+	OP_RMDIR,
+	OP_RENAME,
+	OP_SYMLINK,
+	OP_LINK,
+	OP_CHMOD,
+	OP_CHOWN,
+	OP_CHGRP,
+	OP_SETXATTR,
+	OP_REMOVEXATTR,
+	OP_CHECKPOINT,
+	OP_RESTORE,
+	OP_SEED,
+	NR_REPLAY_OPCODES
+};
+
+#define REPLAY_MAX_FIELDS 8
+
+/*
+ * A line of sequence.log with its arguments converted.  The strings point
+ * into the line buffer given to parse_replay_line(), which must outlive
+ * the op.
+ */
+struct replay_op {
+	enum replay_opcode code;
+	const char *name;
+	const char *path;
+	/* Second path (rename, symlink, link) or xattr name */
+	const char *path2;
+	const char *value;
+	int flags;
+	mode_t mode;
+	int byte;
+	/* Write offset or truncate length */
+	off_t offset;
+	/* Write length or xattr value size */
+	size_t size;
+	/* uid, gid or seed */
+	uint64_t num;
+};
+
+int parse_replay_line(char *line, struct replay_op *op);
+int exec_replay_op(const struct replay_op *op, int seq);
+bool is_replay_fsop(const struct replay_op *op);
 void populate_replay_basepaths();
-void replayer_init(vector_t states);
-void checkpoint(int seq, vector_t states);
-void restore(vector_t states);
+void replayer_init(struct fs_state_stack *states);
+void checkpoint(int seq, struct fs_state_stack *states);
+void restore(struct fs_state_stack *states);
 char *get_replayed_absfs(const char *basepath, unsigned int hash_method, char *abs_state_str);
 void execute_cmd(const char *cmd);
 
@@ -152,8 +152,7 @@ mtd_check:
     }
     // create an empty jffs2 image
     // first prepare an empty directory
-    srand(time(0));
-    randnum = rand() % 65536;
+    randnum = getpid() % 65536;
     snprintf(cmdbuf, PATH_MAX, "mkdir -p /tmp/_empty_dir_%d", randnum);
     execute_cmd(cmdbuf);
     // make the jffs2 image according to the empty directory created
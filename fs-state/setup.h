@@ -33,9 +33,11 @@
 
 #include "nanotiming.h"
 #include "operations.h"
+#include "prng.h"
 #include "errnoname.h"
 #include "vector.h"
 #include "abstract_fs.h"
+#include "path_utils.h"
 #include "set.h"
 #include "log.h"
 #include "init_globals.h"
@@ -75,10 +75,38 @@ extern "C" {
 
     typedef struct abstract_fs absfs_t;
 
+    /* The attributes of a file that make up the abstract state */
+    struct absfs_attrs {
+        mode_t mode;
+        size_t size;
+        nlink_t nlink;
+        uid_t uid;
+        gid_t gid;
+    };
+
     void init_abstract_fs(absfs_t *absfs);
     void destroy_abstract_fs(absfs_t *absfs);
     int scan_abstract_fs(absfs_t *absfs, const char *basepath, bool verbose,
                          printer_t verbose_printer);
+
+    /* Building blocks of scan_abstract_fs(), for those who know the file
+     * tree without walking it (e.g., VeriFS computing its own state).
+     * Files must be fed in the order of their abstract paths, each one
+     * followed by its content if it is a regular file. */
+    bool absfs_is_excluded(const char *abspath);
+    void absfs_feed_file(absfs_t *absfs, const char *abspath,
+                         const char *target_relpath,
+                         const struct absfs_attrs *attrs);
+    int absfs_feed_content(absfs_t *absfs, const void *buf, size_t len);
+    void absfs_feed_xattr(absfs_t *absfs, const char *name, const void *value,
+                          size_t len);
+
+    /* Fold the "user." extended attributes of every file into the abstract
+     * state (off by default).  The attributes of a file are fed right after
+     * absfs_feed_file(), sorted by name, by absfs_feed_xattr(). */
+    void absfs_set_xattr_mode(bool on);
+    bool absfs_xattr_mode(void);
+    int digest_abstract_fs(absfs_t *absfs);
     void print_abstract_fs_state(printer_t printer, const absfs_state_t state);
     void print_filemode(printer_t printer, mode_t mode);
 
@@ -121,22 +149,14 @@ namespace fs = std::experimental::filesystem;
 
 typedef int (*printer_t)(const char *fmt, ...);
 
+/* The paths live in the arena of the scan, which is reset by the next scan */
 struct AbstractFile {
-    std::string fullpath;
+    const char *fullpath;
     /* Abstract path is irrelevant to the basepath of the mount point */
-    std::string abstract_path;
-    /* The target of the symbolic link (for the symlink type only)
-     * as we feed the value to hasher, so this field should 
-     * not be an pointer to a string, but a string itself
-     */
-    std::string target_relpath;
-    struct {
-        mode_t mode;
-        size_t size;
-        nlink_t nlink;
-        uid_t uid;
-        gid_t gid;
-    } attrs;
+    const char *abstract_path;
+    /* The target of the symbolic link (empty for the other types) */
+    const char *target_relpath;
+    struct absfs_attrs attrs;
 
     struct {
         blksize_t blksize;
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2020-2024 Yifei Liu
+ * Copyright (c) 2020-2024 Wei Su
+ * Copyright (c) 2020-2024 Erez Zadok
+ * Copyright (c) 2020-2024 Stony Brook University
+ * Copyright (c) 2020-2024 The Research Foundation of SUNY
+ *
+ * You can redistribute it and/or modify it under the terms of the Apache
+ * License, Version 2.0 (http://www.apache.org/licenses/LICENSE-2.0).
+ */
+
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Bump-pointer arena.  Objects are never freed one by one: the whole arena
+ * is reset at once (arena_reset), or rewound to a mark taken earlier
+ * (arena_get_mark/arena_rewind) for scoped allocations.  The blocks are kept
+ * across resets, so an arena that is reset in a loop stops calling malloc()
+ * once it has grown to the size of one iteration.  A zero-initialized arena
+ * is ready to use, with ARENA_DEFAULT_BLOCK blocks.
+ */
+#define ARENA_DEFAULT_BLOCK (64 * 1024)
+#define ARENA_ALIGN 16
+
+struct arena_block {
+    struct arena_block *next;
+    size_t size;
+    /* Payload follows, ARENA_ALIGN-aligned */
+};
+
+struct arena {
+    /* Blocks in use, the current one first */
+    struct arena_block *blocks;
+    /* Blocks released by resets, reused before malloc() */
+    struct arena_block *spare;
+    char *cur;
+    char *end;
+    size_t block_size;
+};
+
+struct arena_mark {
+    struct arena_block *block;
+    char *cur;
+};
+
+void arena_init(struct arena *a, size_t block_size);
+void arena_destroy(struct arena *a);
+void *arena_alloc(struct arena *a, size_t size);
+char *arena_strdup(struct arena *a, const char *s);
+char *arena_strndup(struct arena *a, const char *s, size_t n);
+void arena_reset(struct arena *a);
+struct arena_mark arena_get_mark(struct arena *a);
+void arena_rewind(struct arena *a, struct arena_mark mark);
+
+/*
+ * Pool of fixed-size objects carved from an arena, with a free list, for
+ * objects that are released one by one in any order.
+ */
+struct pool {
+    struct arena arena;
+    size_t objsize;
+    void *free_list;
+    size_t nused;
+};
+
+void pool_init(struct pool *p, size_t objsize, size_t objs_per_block);
+void pool_destroy(struct pool *p);
+void *pool_get(struct pool *p);
+void pool_put(struct pool *p, void *obj);
+/* Release all the objects at once */
+void pool_reset(struct pool *p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _ARENA_H
@@ -23,6 +23,7 @@
 #include <string.h>
 #include <errno.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -31,6 +32,9 @@
 
 #define CBUF_SIZE 10
 #define KB_TO_BYTES 1024
+/* Images are copied in units of pages, as reported dirty by brd */
+#define CBUF_PAGE_SIZE 4096
+#define CBUF_BITMAP_WORDS(npages) (((npages) + 63) / 64)
 
 struct fsimg_buf {
     void *state; // concrete state (f/s image buffer)
@@ -46,6 +50,9 @@ struct circular_buf {
     fsimg_buf_t img_buf[CBUF_SIZE];
     size_t head_idx; // [0, CBUF_SIZE - 1]
     size_t size; // The size of currently saved images, size <= CBUF_SIZE
+    size_t npages; // number of CBUF_PAGE_SIZE pages of an image
+    // Pages in which each image differs from the device, one bit per page
+    uint64_t *stale[CBUF_SIZE];
 };
 
 typedef struct circular_buf circular_buf_t;
@@ -62,6 +69,7 @@ typedef struct circular_buf_sum circular_buf_sum_t;
 void circular_buf_init(circular_buf_sum_t **fsimg_bufs, int n_fs, size_t *devsize_kb);
 void insert_circular_buf(circular_buf_sum_t *fsimg_bufs, int fs_idx, 
                             size_t devsize_kb, void *save_state, 
+                            const uint64_t *dirty,
                             size_t state_depth, size_t seq_id, bool is_ckpt);
 void dump_all_circular_bufs(circular_buf_sum_t *fsimg_bufs, char **fslist, 
     size_t *devsize_kb);
@@ -17,17 +17,31 @@ extern "C" {
 #endif
 #include <sys/ioctl.h>
 #include <stddef.h>
+#include <stdint.h>
 
 struct verifs_str {
   size_t len;
   char *str;
 };
 
+struct verifs_pool_stat {
+  uint64_t nstates;         // number of saved states
+  uint64_t nbytes;          // bytes held by all saved states
+  uint64_t resident_bytes;  // bytes of the states kept in memory
+  uint64_t max_bytes;       // cap of resident_bytes, 0 if unlimited
+};
+
+struct verifs_absfs {
+  unsigned int hash_option;
+  unsigned char state[16];
+};
+
 #define VERIFS_IOC_CODE    '1'
 #define VERIFS_IOC_NO(x)   (VERIFS_IOC_CODE + (x))
 #define VERIFS_IOC(n)      _IO(VERIFS_IOC_CODE, VERIFS_IOC_NO(n))
 #define VERIFS_GET_IOC(n, type)  _IOR(VERIFS_IOC_CODE, VERIFS_IOC_NO(n), type)
 #define VERIFS_SET_IOC(n, type)  _IOW(VERIFS_IOC_CODE, VERIFS_IOC_NO(n), type)
+#define VERIFS_GETSET_IOC(n, type)  _IOWR(VERIFS_IOC_CODE, VERIFS_IOC_NO(n), type)
 
 #define VERIFS_CHECKPOINT  VERIFS_IOC(1)
 #define VERIFS_RESTORE     VERIFS_IOC(2)
@@ -37,6 +51,15 @@ struct verifs_str {
 #define VERIFS_PICKLE      VERIFS_SET_IOC(3, struct verifs_str)
 #define VERIFS_LOAD        VERIFS_SET_IOC(4, struct verifs_str)
 
+// the ABSTRACT_STATE takes the hash method in `hash_option` (see enum
+// hash_type in abstract_fs.h) and returns the abstract state computed by the
+// file system itself in `state`. It must be identical to scan_abstract_fs().
+#define VERIFS_ABSTRACT_STATE  VERIFS_GETSET_IOC(5, struct verifs_absfs)
+
+// the POOL_STAT reports the usage of the pool of checkpointed states, like
+// statfs() does for the file system itself.
+#define VERIFS_POOL_STAT   VERIFS_GET_IOC(6, struct verifs_pool_stat)
+
 #ifdef __cplusplus
 }
 #endif
@@ -12,15 +12,36 @@
 #ifndef _CUSTOM_HEAP_H
 #define _CUSTOM_HEAP_H
 
+#include <stdbool.h>
 #include <stddef.h>
 
+/* File or block device mapped as the heap */
+#define CUSTOM_HEAP_PATH_ENV "CUSTOM_HEAP_PATH"
+/* Size in MiB of an anonymous heap, used when no path is given */
+#define CUSTOM_HEAP_SIZE_ENV "CUSTOM_HEAP_SIZE"
+/* "hugetlb" or "thp" to back the heap with huge pages */
+#define CUSTOM_HEAP_HUGE_ENV "CUSTOM_HEAP_HUGEPAGES"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 void try_init_myheap(void);
-void *my_morecore(ptrdiff_t increment);
 void unset_myheap(void);
+bool myheap_ready(void);
+bool myheap_owns(const void *ptr);
+size_t myheap_in_use(void);
+
+/*
+ * pan.c reaches these through pan_heap.h; everything else calls them
+ * explicitly.  They fall back to libc when the heap is not set up or is
+ * full, and myheap_free()/myheap_realloc() accept pointers allocated by
+ * libc.
+ */
+void *myheap_malloc(size_t size);
+void *myheap_calloc(size_t nmemb, size_t size);
+void *myheap_realloc(void *ptr, size_t size);
+void myheap_free(void *ptr);
 
 #ifdef __cplusplus
 }
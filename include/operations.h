@@ -16,6 +16,7 @@
 #include <sys/types.h>
 #include <stdint.h>
 #include <math.h>
+#include "prng.h"
 
 #ifndef _OPERATIONS_H
 #define _OPERATIONS_H
@@ -54,12 +55,20 @@
 #define USE_CREATE_FLAG 0
 #define USE_WRITE_FLAG 1
 
+/* Largest write served from the write pattern pool without allocating.
+ * The pool reserves 256 slots of this size but only touches what it uses. */
+#define WRITE_POOL_MAX_SIZE (1UL << 20)
+
 // Write size fixed macros
 #define WRITE_SIZE_PARTS 33
 
 // Rank-size distribution for write size 
 #define WRITE_SIZE_RZD_RATIO 0.9
 
+// Number of open flag patterns and write size patterns above
+#define OPEN_FLAG_PATTERNS 6
+#define WRITE_SIZE_PATTERNS 3
+
 typedef struct all_inputs {
     int create_open_flag;
     int write_open_flag;
@@ -77,10 +86,33 @@ typedef struct write_size_partition {
 // We investigate 34 write size partitions: equal to 0, 0, 1, ... 31, 32
 extern writesz_partition_t writesz_parts[WRITE_SIZE_PARTS];
 
+// Biased coins compare a uniform PRNG_DRAW_BITS-bit draw to a threshold
+#define PRNG_DRAW_BITS 53
+#define PRNG_DRAW_RANGE (1ULL << PRNG_DRAW_BITS)
+
+static inline uint64_t prng_draw(void)
+{
+    return mcfs_prng_next() >> (64 - PRNG_DRAW_BITS);
+}
+
+/*
+ * Walker/Vose alias table: sampling an index of a discrete distribution
+ * over n outcomes takes one uniform pick of a column i plus one biased coin,
+ * which keeps i if prng_draw() < thresh[i] and takes alias[i] otherwise.
+ */
+typedef struct alias_table {
+    int n;
+    uint64_t thresh[WRITE_SIZE_PARTS];
+    int alias[WRITE_SIZE_PARTS];
+} alias_table_t;
+
+void build_alias_table(alias_table_t *tbl, const double *weights, int n);
+int sample_alias_table(const alias_table_t *tbl);
+
 // Random integer generator [min, max] included
 static inline size_t rand_size(size_t min, size_t max)
 {
-   return min + rand() % (max + 1 - min);
+   return mcfs_prng_range(min, max);
 }
 
 void populate_writesz_parts();
@@ -104,10 +136,15 @@ extern double inv_rzdFlagPercent[MAX_FLAG_BITS];
 
 int create_file(const char *path, int flags, int mode);
 ssize_t write_file(const char *path, int flags, void *data, off_t offset, size_t length);
+ssize_t write_file_byte(const char *path, int flags, int byte, off_t offset, size_t length);
 int fallocate_file(const char *path, off_t offset, off_t len);
 int chown_file(const char *path, uid_t owner);
 int chgrp_file(const char *path, gid_t group);
 
+// Write pattern pool: page-aligned buffers of a repeated byte
+void write_pool_init();
+const void *write_pool_get(int byte, size_t len);
+
 // Driver functions
 int pick_open_flags(int pattern, int ops);
 size_t pick_write_sizes(int pattern);
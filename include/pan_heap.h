@@ -0,0 +1,30 @@
+/*
+ * Copyright (c) 2020-2024 Yifei Liu
+ * Copyright (c) 2020-2024 Wei Su
+ * Copyright (c) 2020-2024 Erez Zadok
+ * Copyright (c) 2020-2024 Stony Brook University
+ * Copyright (c) 2020-2024 The Research Foundation of SUNY
+ *
+ * You can redistribute it and/or modify it under the terms of the Apache
+ * License, Version 2.0 (http://www.apache.org/licenses/LICENSE-2.0).
+ */
+
+#ifndef _PAN_HEAP_H
+#define _PAN_HEAP_H
+
+/*
+ * Forced into pan.c only (gcc -include pan_heap.h, see make HEAP=1), so
+ * that SPIN's state storage and the model's c_code allocate from the custom
+ * heap.  The common libraries are built without it and keep using libc;
+ * pointers can still cross over because myheap_free() and myheap_realloc()
+ * hand the ones the heap does not own back to libc.
+ */
+#include <stdlib.h>
+#include "custom_heap.h"
+
+#define malloc(size) myheap_malloc(size)
+#define calloc(nmemb, size) myheap_calloc(nmemb, size)
+#define realloc(ptr, size) myheap_realloc(ptr, size)
+#define free(ptr) myheap_free(ptr)
+
+#endif
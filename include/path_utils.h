@@ -29,6 +29,14 @@ extern "C" {
 
 #include <stdarg.h>
 
+/**
+ * Largest number of components the functions below handle.  They keep the
+ * components in arrays of this size on the stack and never allocate
+ * (except tc_path_tokenize).  Paths in Metis are at most PATH_DEPTH deep
+ * below a mount point.
+ */
+#define TC_PATH_MAX_COMPONENTS 256
+
 /**
  * Tokenize "path" into "components"; return the number of components inside
  * path on success, or -1 on failure.
@@ -38,6 +46,18 @@ extern "C" {
 int tc_path_tokenize(const char *path, slice_t **components);
 int tc_path_tokenize_s(slice_t path, slice_t **components);
 
+/**
+ * Tokenize "path" into the caller's array "components" of "max_components"
+ * entries, without allocating.  The components point into "path".
+ *
+ * Returns the number of components, or -1 if there are more than
+ * "max_components".
+ */
+int tc_path_tokenize_into(const char *path, slice_t *components,
+                          int max_components);
+int tc_path_tokenize_into_s(slice_t path, slice_t *components,
+                            int max_components);
+
 /**
  * Normalize a path and save the result into "buf".  Normalization include
  * removing ".", "..", consecutive "//", and trailing "/".
@@ -56,6 +76,15 @@ int tc_path_tokenize_s(slice_t path, slice_t **components);
 int tc_path_normalize(const char *path, char *buf, size_t buf_size);
 int tc_path_normalize_s(slice_t path, buf_t *pbuf);
 
+/**
+ * Normalize "path" in place, in one pass and without any limit on the
+ * number of components.  "path" must have room for 2 bytes, as "" becomes
+ * ".".
+ *
+ * Returns the size of the normalized path.
+ */
+int tc_path_normalize_inplace(char *path);
+
 /**
  * Return the depth of the path in the FS tree. "/" is zero; "/foo" is one;
  * "/foo/bar" is two.
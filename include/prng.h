@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2020-2024 Yifei Liu
+ * Copyright (c) 2020-2024 Wei Su
+ * Copyright (c) 2020-2024 Erez Zadok
+ * Copyright (c) 2020-2024 Stony Brook University
+ * Copyright (c) 2020-2024 The Research Foundation of SUNY
+ *
+ * You can redistribute it and/or modify it under the terms of the Apache
+ * License, Version 2.0 (http://www.apache.org/licenses/LICENSE-2.0).
+ */
+
+#ifndef _PRNG_H_
+#define _PRNG_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Environment variable to run with a given seed instead of a fresh one */
+#define MCFS_SEED_ENV "MCFS_SEED"
+
+/*
+ * xoshiro256** generator.  Every VT is a separate process and draws from
+ * its own copy, so there is no locking.  The state is a plain struct so
+ * that SPIN can track it (see mcfs-main.pml).
+ */
+typedef struct prng_state {
+    uint64_t s[4];
+} prng_state_t;
+
+extern prng_state_t mcfs_prng;
+
+/**
+ * mcfs_prng_seed:- Reset the generator to the sequence of @seed
+ */
+void mcfs_prng_seed(uint64_t seed);
+/**
+ * mcfs_prng_init:- Seed the generator once, from MCFS_SEED if it is set
+ *                  and from /dev/urandom otherwise.  Returns the seed,
+ *                  which the caller should log so the run can be repeated.
+ */
+uint64_t mcfs_prng_init(void);
+uint64_t mcfs_prng_get_seed(void);
+
+static inline uint64_t prng_rotl(const uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+static inline uint64_t mcfs_prng_next(void)
+{
+    uint64_t *s = mcfs_prng.s;
+    const uint64_t result = prng_rotl(s[1] * 5, 7) * 9;
+    const uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = prng_rotl(s[3], 45);
+    return result;
+}
+
+/* Uniform double in [0, 1) */
+static inline double mcfs_prng_double(void)
+{
+    return (mcfs_prng_next() >> 11) * 0x1.0p-53;
+}
+
+/* Uniform integer in [0, n); n must be greater than 0 */
+static inline uint64_t mcfs_prng_below(uint64_t n)
+{
+    return (uint64_t)(((unsigned __int128)mcfs_prng_next() * n) >> 64);
+}
+
+/* Uniform integer in [min, max], both included */
+static inline uint64_t mcfs_prng_range(uint64_t min, uint64_t max)
+{
+    if (max - min == UINT64_MAX)
+        return mcfs_prng_next();
+    return min + mcfs_prng_below(max - min + 1);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
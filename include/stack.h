@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2020-2024 Yifei Liu
+ * Copyright (c) 2020-2024 Wei Su
+ * Copyright (c) 2020-2024 Erez Zadok
+ * Copyright (c) 2020-2024 Stony Brook University
+ * Copyright (c) 2020-2024 The Research Foundation of SUNY
+ *
+ * You can redistribute it and/or modify it under the terms of the Apache
+ * License, Version 2.0 (http://www.apache.org/licenses/LICENSE-2.0).
+ */
+
+#ifndef _STACK_H
+#define _STACK_H
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+/*
+ * Typed, growth-stable stacks for push/pop-heavy code (checkpoint stacks,
+ * log queues).  Unlike vector.h:
+ *  - elements are typed, so push and pop are plain assignments;
+ *  - the capacity doubles when full, but only halves once the length drops
+ *    below a quarter of it, so alternating push/pop around a boundary never
+ *    reallocates;
+ *  - clear() keeps the memory, and reserve() preallocates it.
+ *
+ * DEFINE_STACK(name, type) defines struct name and its functions
+ * name_init(), name_push(), name_emplace(), name_top(), name_pop(), ...
+ */
+#define STACK_MIN_CAP 16
+
+#define DEFINE_STACK(name, type)                                            \
+struct name {                                                               \
+    type *data;                                                             \
+    size_t len;                                                             \
+    size_t cap;                                                             \
+};                                                                          \
+                                                                            \
+static inline void name##_init(struct name *s) {                            \
+    s->data = NULL;                                                         \
+    s->len = s->cap = 0;                                                    \
+}                                                                           \
+                                                                            \
+static inline void name##_destroy(struct name *s) {                         \
+    free(s->data);                                                          \
+    name##_init(s);                                                         \
+}                                                                           \
+                                                                            \
+static inline int name##_resize_cap(struct name *s, size_t cap) {           \
+    type *data = (type *)realloc(s->data, cap * sizeof(type));              \
+    if (!data)                                                              \
+        return ENOMEM;                                                      \
+    s->data = data;                                                         \
+    s->cap = cap;                                                           \
+    return 0;                                                               \
+}                                                                           \
+                                                                            \
+/* Make room for at least n elements */                                     \
+static inline int name##_reserve(struct name *s, size_t n) {                \
+    if (n <= s->cap)                                                        \
+        return 0;                                                           \
+    return name##_resize_cap(s, n < STACK_MIN_CAP ? STACK_MIN_CAP : n);     \
+}                                                                           \
+                                                                            \
+/* Append an uninitialized element and return it, or NULL without memory */\
+static inline type *name##_emplace(struct name *s) {                        \
+    if (s->len == s->cap &&                                                 \
+        name##_reserve(s, s->cap ? s->cap * 2 : STACK_MIN_CAP) != 0)        \
+        return NULL;                                                        \
+    return &s->data[s->len++];                                              \
+}                                                                           \
+                                                                            \
+static inline int name##_push(struct name *s, type el) {                    \
+    type *slot = name##_emplace(s);                                         \
+    if (!slot)                                                              \
+        return ENOMEM;                                                      \
+    *slot = el;                                                             \
+    return 0;                                                               \
+}                                                                           \
+                                                                            \
+static inline type *name##_top(struct name *s) {                            \
+    return s->len ? &s->data[s->len - 1] : NULL;                            \
+}                                                                           \
+                                                                            \
+static inline type *name##_get(struct name *s, size_t index) {              \
+    return index < s->len ? &s->data[index] : NULL;                         \
+}                                                                           \
+                                                                            \
+/* Remove the top element, copied to *out if out is not NULL */             \
+static inline bool name##_pop(struct name *s, type *out) {                  \
+    if (s->len == 0)                                                        \
+        return false;                                                       \
+    s->len--;                                                               \
+    if (out)                                                                \
+        *out = s->data[s->len];                                             \
+    if (s->cap > STACK_MIN_CAP && s->len < s->cap / 4)                      \
+        name##_resize_cap(s, s->cap / 2);                                   \
+    return true;                                                            \
+}                                                                           \
+                                                                            \
+/* Remove all the elements but keep the memory */                           \
+static inline void name##_clear(struct name *s) {                           \
+    s->len = 0;                                                             \
+}
+
+#define stack_foreach(s, entry) \
+    for (entry = (s)->data; entry && entry < (s)->data + (s)->len; ++entry)
+
+#ifdef __cplusplus
+#include <new>
+#include <utility>
+
+/* The same container for C++ code, which also runs the element destructors */
+template <typename T>
+class Stack {
+public:
+  Stack() : data_(nullptr), len_(0), cap_(0) {}
+  ~Stack() {
+    clear();
+    free(data_);
+  }
+  Stack(const Stack &) = delete;
+  Stack &operator=(const Stack &) = delete;
+
+  size_t size() const { return len_; }
+  size_t capacity() const { return cap_; }
+  bool empty() const { return len_ == 0; }
+  T *begin() { return data_; }
+  T *end() { return data_ + len_; }
+  T &top() { return data_[len_ - 1]; }
+  T &operator[](size_t i) { return data_[i]; }
+
+  void reserve(size_t n) {
+    if (n > cap_)
+      set_capacity(n < STACK_MIN_CAP ? STACK_MIN_CAP : n);
+  }
+
+  template <typename... Args>
+  T &emplace(Args &&...args) {
+    if (len_ == cap_)
+      reserve(cap_ ? cap_ * 2 : STACK_MIN_CAP);
+    T *slot = new (data_ + len_) T(std::forward<Args>(args)...);
+    len_++;
+    return *slot;
+  }
+
+  void push(const T &el) { emplace(el); }
+
+  void pop() {
+    data_[--len_].~T();
+    if (cap_ > STACK_MIN_CAP && len_ < cap_ / 4)
+      set_capacity(cap_ / 2);
+  }
+
+  /* Destroy the elements but keep the memory */
+  void clear() {
+    while (len_ > 0)
+      data_[--len_].~T();
+  }
+
+private:
+  T *data_;
+  size_t len_;
+  size_t cap_;
+
+  void set_capacity(size_t cap) {
+    T *data = static_cast<T *>(malloc(cap * sizeof(T)));
+    if (!data)
+      throw std::bad_alloc();
+    for (size_t i = 0; i < len_; ++i) {
+      new (data + i) T(std::move(data_[i]));
+      data_[i].~T();
+    }
+    free(data_);
+    data_ = data;
+    cap_ = cap;
+  }
+};
+#endif
+
+#endif // _STACK_H
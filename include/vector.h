@@ -84,13 +84,20 @@ static inline void *_vector_peek_top(struct vector *vec) {
 #define vector_peek_top(vec, type) \
     (type *)_vector_peek_top(vec)
 
+/* Halve the capacity once the vector is a quarter full, so that it does not
+ * shrink and grow again around the same length (see also stack.h) */
 static inline void vector_try_shrink(struct vector *vec) {
-    if (vec->len >= vec->capacity / 2)
+    if (vec->len >= vec->capacity / 4)
         return;
-    if (vec->len <= DEFAULT_INITCAP)
+    if (vec->capacity / 2 < DEFAULT_INITCAP)
         return;
-    size_t newcap = vec->capacity / 2 * vec->unitsize;
-    vec->data = (unsigned char *)realloc(vec->data, newcap);
+    size_t newcap = vec->capacity / 2;
+    unsigned char *newptr =
+        (unsigned char *)realloc(vec->data, newcap * vec->unitsize);
+    if (newptr == NULL)
+        return;
+    vec->data = newptr;
+    vec->capacity = newcap;
 }
 
 static inline void vector_pop_back(struct vector *vec) {
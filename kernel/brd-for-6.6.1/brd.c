@@ -24,9 +24,12 @@
 #include <linux/slab.h>
 #include <linux/backing-dev.h>
 #include <linux/debugfs.h>
+#include <linux/xxhash.h>
 
 #include <linux/uaccess.h>
 
+#include "brd_ioctl.h"
+
 /* Max number of different sizes */
 #define MAX_RD_SIZES_CNT	32
 
@@ -47,10 +50,43 @@ struct brd_device {
 	 */
 	struct xarray	        brd_pages;
 	u64			brd_nr_pages;
+
+	/*
+	 * Snapshots taken by BRD_SNAPSHOT. A page shared with a snapshot has
+	 * an elevated refcount and is copied before it gets written.
+	 */
+	struct mutex		brd_snap_mutex;
+	struct list_head	brd_snapshots;
+
+	/*
+	 * Pages written since the last BRD_GET_DIRTY, one bit per page.
+	 */
+	unsigned long		*brd_dirty;
+	unsigned long		brd_dirty_bits;
+	/*
+	 * Set by BRD_COMPARE_WRITES while an image is restored over the
+	 * device: a write of the data a page already holds leaves it clean.
+	 */
+	bool			brd_compare_writes;
+};
+
+struct brd_snapshot {
+	u64			id;
+	struct list_head	list;
+	struct xarray		pages;
+	u64			nr_pages;
 };
 
+static inline void brd_mark_dirty(struct brd_device *brd, pgoff_t idx)
+{
+	if (likely(idx < brd->brd_dirty_bits))
+		set_bit(idx, brd->brd_dirty);
+}
+
 /*
- * Look up and return a brd's page for a given sector.
+ * Look up and return a brd's page for a given sector. Discards free pages
+ * concurrently, so the page is only valid until rcu_read_unlock(), unless
+ * the caller takes a reference.
  */
 static struct page *brd_lookup_page(struct brd_device *brd, sector_t sector)
 {
@@ -65,8 +101,72 @@ static struct page *brd_lookup_page(struct brd_device *brd, sector_t sector)
 	return page;
 }
 
+static void brd_free_one(struct rcu_head *head)
+{
+	__free_page(container_of(head, struct page, rcu_head));
+}
+
+/*
+ * Drop a reference to a page. Every xarray holding the page holds a
+ * reference, so the last one belongs to a caller that already removed the
+ * page; it is freed after a grace period, once no bio can be copying it.
+ */
+static void brd_put_page(struct page *page)
+{
+	if (!page_ref_add_unless(page, -1, 1))
+		call_rcu(&page->rcu_head, brd_free_one);
+}
+
+/*
+ * Give the device its own copy of the page at idx if it shares it with
+ * snapshots, so that the page can be written without changing them.
+ */
+static int brd_unshare_page(struct brd_device *brd, pgoff_t idx, gfp_t gfp)
+{
+	struct page *page, *copy, *cur;
+
+again:
+	rcu_read_lock();
+	page = xa_load(&brd->brd_pages, idx);
+	if (!page || page_count(page) == 1) {
+		rcu_read_unlock();
+		return 0;
+	}
+	/* A discard may free the page while it is copied */
+	get_page(page);
+	rcu_read_unlock();
+
+	copy = alloc_page(gfp | __GFP_HIGHMEM);
+	if (!copy) {
+		brd_put_page(page);
+		return -ENOMEM;
+	}
+	copy_highpage(copy, page);
+	copy->index = idx;
+
+	xa_lock(&brd->brd_pages);
+	cur = __xa_cmpxchg(&brd->brd_pages, idx, page, copy, gfp);
+	xa_unlock(&brd->brd_pages);
+	brd_put_page(page);
+
+	if (unlikely(cur != page)) {
+		__free_page(copy);
+		if (xa_is_err(cur))
+			return xa_err(cur);
+		/*
+		 * Another writer replaced the page first. Its copy is private
+		 * unless a snapshot was taken since, so check it again.
+		 */
+		goto again;
+	}
+	/* Drop the device's reference; the snapshots keep theirs */
+	brd_put_page(page);
+	return 0;
+}
+
 /*
  * Insert a new page for a given sector, if one does not already exist.
+ * An existing page shared with a snapshot is replaced by a private copy.
  */
 static int brd_insert_page(struct brd_device *brd, sector_t sector, gfp_t gfp)
 {
@@ -74,9 +174,9 @@ static int brd_insert_page(struct brd_device *brd, sector_t sector, gfp_t gfp)
 	struct page *page, *cur;
 	int ret = 0;
 
-	page = brd_lookup_page(brd, sector);
-	if (page)
-		return 0;
+	idx = sector >> PAGE_SECTORS_SHIFT;
+	if (xa_load(&brd->brd_pages, idx))
+		return brd_unshare_page(brd, idx, gfp);
 
 	page = alloc_page(gfp | __GFP_ZERO | __GFP_HIGHMEM);
 	if (!page)
@@ -84,7 +184,6 @@ static int brd_insert_page(struct brd_device *brd, sector_t sector, gfp_t gfp)
 
 	xa_lock(&brd->brd_pages);
 
-	idx = sector >> PAGE_SECTORS_SHIFT;
 	page->index = idx;
 
 	cur = __xa_cmpxchg(&brd->brd_pages, idx, NULL, page, gfp);
@@ -143,21 +242,33 @@ static int copy_to_brd_setup(struct brd_device *brd, sector_t sector, size_t n,
 
 /*
  * Copy n bytes from src to the brd starting at sector. Does not sleep.
+ * Returns -EAGAIN if a discard freed a page since copy_to_brd_setup(); the
+ * caller sets it up again and retries.
  */
-static void copy_to_brd(struct brd_device *brd, const void *src,
-			sector_t sector, size_t n)
+static int copy_to_brd(struct brd_device *brd, const void *src,
+		       sector_t sector, size_t n)
 {
 	struct page *page;
 	void *dst;
 	unsigned int offset = (sector & (PAGE_SECTORS-1)) << SECTOR_SHIFT;
 	size_t copy;
+	/* Only restores pay for the compare, see brd_compare_writes */
+	bool compare = READ_ONCE(brd->brd_compare_writes);
+	int ret = 0;
 
+	rcu_read_lock();
 	copy = min_t(size_t, n, PAGE_SIZE - offset);
 	page = brd_lookup_page(brd, sector);
-	BUG_ON(!page);
+	if (!page) {
+		ret = -EAGAIN;
+		goto out;
+	}
 
 	dst = kmap_atomic(page);
-	memcpy(dst + offset, src, copy);
+	if (!compare || memcmp(dst + offset, src, copy)) {
+		memcpy(dst + offset, src, copy);
+		brd_mark_dirty(brd, page->index);
+	}
 	kunmap_atomic(dst);
 
 	if (copy < n) {
@@ -165,12 +276,21 @@ static void copy_to_brd(struct brd_device *brd, const void *src,
 		sector += copy >> SECTOR_SHIFT;
 		copy = n - copy;
 		page = brd_lookup_page(brd, sector);
-		BUG_ON(!page);
+		if (!page) {
+			ret = -EAGAIN;
+			goto out;
+		}
 
 		dst = kmap_atomic(page);
-		memcpy(dst, src, copy);
+		if (!compare || memcmp(dst, src, copy)) {
+			memcpy(dst, src, copy);
+			brd_mark_dirty(brd, page->index);
+		}
 		kunmap_atomic(dst);
 	}
+out:
+	rcu_read_unlock();
+	return ret;
 }
 
 /*
@@ -184,6 +304,7 @@ static void copy_from_brd(void *dst, struct brd_device *brd,
 	unsigned int offset = (sector & (PAGE_SECTORS-1)) << SECTOR_SHIFT;
 	size_t copy;
 
+	rcu_read_lock();
 	copy = min_t(size_t, n, PAGE_SIZE - offset);
 	page = brd_lookup_page(brd, sector);
 	if (page) {
@@ -205,6 +326,83 @@ static void copy_from_brd(void *dst, struct brd_device *brd,
 		} else
 			memset(dst, 0, copy);
 	}
+	rcu_read_unlock();
+}
+
+/*
+ * Free the page at idx, which then reads as zeros. Returns whether there
+ * was a page; the caller marks it dirty if that changes its content.
+ */
+static bool brd_free_page(struct brd_device *brd, pgoff_t idx)
+{
+	struct page *page;
+
+	xa_lock(&brd->brd_pages);
+	page = __xa_erase(&brd->brd_pages, idx);
+	if (page)
+		brd->brd_nr_pages--;
+	xa_unlock(&brd->brd_pages);
+
+	if (page)
+		brd_put_page(page);
+	return page != NULL;
+}
+
+/*
+ * Make n bytes starting at sector read as zeros. Whole pages are freed
+ * rather than kept, so zeroed regions cost no memory. Partial pages are
+ * zeroed in place: freeing one that became all zeros would race with a
+ * write to the rest of it.
+ */
+static int brd_zero_range(struct brd_device *brd, sector_t sector, size_t n,
+			  gfp_t gfp)
+{
+	while (n > 0) {
+		unsigned int offset = (sector & (PAGE_SECTORS-1)) << SECTOR_SHIFT;
+		size_t len = min_t(size_t, n, PAGE_SIZE - offset);
+		pgoff_t idx = sector >> PAGE_SECTORS_SHIFT;
+		struct page *page;
+		void *dst;
+		bool zero = false;
+		int err;
+
+		rcu_read_lock();
+		page = brd_lookup_page(brd, sector);
+		if (page) {
+			dst = kmap_atomic(page);
+			zero = !memchr_inv(dst + offset, 0, len);
+			kunmap_atomic(dst);
+		}
+		rcu_read_unlock();
+
+		sector += len >> SECTOR_SHIFT;
+		n -= len;
+		if (!page)
+			continue;
+		if (len == PAGE_SIZE) {
+			brd_free_page(brd, idx);
+			if (!zero)
+				brd_mark_dirty(brd, idx);
+			continue;
+		}
+		if (zero)
+			continue;
+
+		/* Partial page: zero the range in a page of our own */
+		err = brd_unshare_page(brd, idx, gfp);
+		if (err)
+			return err;
+		rcu_read_lock();
+		page = xa_load(&brd->brd_pages, idx);
+		if (page) {
+			dst = kmap_atomic(page);
+			memset(dst + offset, 0, len);
+			kunmap_atomic(dst);
+			brd_mark_dirty(brd, idx);
+		}
+		rcu_read_unlock();
+	}
+	return 0;
 }
 
 /*
@@ -224,19 +422,44 @@ static int brd_do_bvec(struct brd_device *brd, struct page *page,
 		 */
 		gfp_t gfp = opf & REQ_NOWAIT ? GFP_NOWAIT : GFP_NOIO;
 
-		err = copy_to_brd_setup(brd, sector, len, gfp);
-		if (err)
-			goto out;
+		/*
+		 * A whole page of zeros (e.g. dd if=/dev/zero, or mkfs zeroing
+		 * its tables) reads the same as no page, so the page is freed
+		 * instead of stored. The page is erased under the xarray lock;
+		 * a concurrent write to it retries on -EAGAIN or lands on the
+		 * old page, as if it had come first.
+		 */
+		if (len == PAGE_SIZE && !(sector & (PAGE_SECTORS - 1))) {
+			bool zero;
+
+			mem = kmap_atomic(page);
+			zero = !memchr_inv(mem + off, 0, len);
+			kunmap_atomic(mem);
+			if (zero) {
+				pgoff_t idx = sector >> PAGE_SECTORS_SHIFT;
+
+				if (brd_free_page(brd, idx))
+					brd_mark_dirty(brd, idx);
+				goto out;
+			}
+		}
+
+		/* A discard may free the pages again before the copy */
+		do {
+			err = copy_to_brd_setup(brd, sector, len, gfp);
+			if (err)
+				goto out;
+			mem = kmap_atomic(page);
+			flush_dcache_page(page);
+			err = copy_to_brd(brd, mem + off, sector, len);
+			kunmap_atomic(mem);
+		} while (err == -EAGAIN);
+		goto out;
 	}
 
 	mem = kmap_atomic(page);
-	if (!op_is_write(opf)) {
-		copy_from_brd(mem + off, brd, sector, len);
-		flush_dcache_page(page);
-	} else {
-		flush_dcache_page(page);
-		copy_to_brd(brd, mem + off, sector, len);
-	}
+	copy_from_brd(mem + off, brd, sector, len);
+	flush_dcache_page(page);
 	kunmap_atomic(mem);
 
 out:
@@ -250,6 +473,21 @@ static void brd_submit_bio(struct bio *bio)
 	struct bio_vec bvec;
 	struct bvec_iter iter;
 
+	/* Discarded and zeroed ranges read as zeros and hold no pages */
+	if (unlikely(op_is_discard(bio->bi_opf) ||
+		     bio_op(bio) == REQ_OP_WRITE_ZEROES)) {
+		gfp_t gfp = bio->bi_opf & REQ_NOWAIT ? GFP_NOWAIT : GFP_NOIO;
+		int err = brd_zero_range(brd, sector, bio->bi_iter.bi_size, gfp);
+
+		if (err == -ENOMEM && bio->bi_opf & REQ_NOWAIT)
+			bio_wouldblock_error(bio);
+		else if (err)
+			bio_io_error(bio);
+		else
+			bio_endio(bio);
+		return;
+	}
+
 	bio_for_each_segment(bvec, bio, iter) {
 		unsigned int len = bvec.bv_len;
 		int err;
@@ -274,9 +512,285 @@ static void brd_submit_bio(struct bio *bio)
 	bio_endio(bio);
 }
 
+static struct brd_snapshot *brd_find_snapshot(struct brd_device *brd, u64 id)
+{
+	struct brd_snapshot *snap;
+
+	list_for_each_entry(snap, &brd->brd_snapshots, list)
+		if (snap->id == id)
+			return snap;
+	return NULL;
+}
+
+/*
+ * Drop the snapshot's references to its pages. Pages still used by the
+ * device or by other snapshots stay around.
+ */
+static void brd_free_snapshot(struct brd_snapshot *snap)
+{
+	struct page *page;
+	unsigned long idx;
+
+	xa_for_each(&snap->pages, idx, page) {
+		brd_put_page(page);
+		cond_resched();
+	}
+	xa_destroy(&snap->pages);
+	list_del(&snap->list);
+	kfree(snap);
+}
+
+/*
+ * Take a snapshot by sharing all pages of the device with it. Nothing is
+ * copied here; brd_insert_page() copies a shared page on its next write.
+ */
+static int brd_snapshot(struct brd_device *brd, u64 id)
+{
+	struct brd_snapshot *snap;
+	struct page *page;
+	unsigned long idx;
+	int err = 0;
+
+	if (brd_find_snapshot(brd, id))
+		return -EEXIST;
+
+	snap = kzalloc(sizeof(*snap), GFP_KERNEL);
+	if (!snap)
+		return -ENOMEM;
+	snap->id = id;
+	xa_init(&snap->pages);
+	list_add(&snap->list, &brd->brd_snapshots);
+
+	xa_for_each(&brd->brd_pages, idx, page) {
+		get_page(page);
+		err = xa_err(xa_store(&snap->pages, idx, page, GFP_KERNEL));
+		if (err) {
+			__free_page(page);
+			break;
+		}
+		snap->nr_pages++;
+		cond_resched();
+	}
+
+	if (err)
+		brd_free_snapshot(snap);
+	return err;
+}
+
+/*
+ * Swap the device's pages for the snapshot's ones and drop the snapshot.
+ * If this fails, the snapshot is kept so that the restore can be retried.
+ */
+static int brd_restore(struct brd_device *brd, u64 id)
+{
+	struct brd_snapshot *snap;
+	struct page *page;
+	unsigned long idx;
+	int err;
+
+	snap = brd_find_snapshot(brd, id);
+	if (!snap)
+		return -ENOENT;
+
+	xa_for_each(&brd->brd_pages, idx, page) {
+		xa_erase(&brd->brd_pages, idx);
+		brd_put_page(page);
+		brd_mark_dirty(brd, idx);
+		cond_resched();
+	}
+	brd->brd_nr_pages = 0;
+
+	xa_for_each(&snap->pages, idx, page) {
+		brd_mark_dirty(brd, idx);
+		get_page(page);
+		err = xa_err(xa_store(&brd->brd_pages, idx, page, GFP_KERNEL));
+		if (err) {
+			__free_page(page);
+			return err;
+		}
+		brd->brd_nr_pages++;
+		cond_resched();
+	}
+
+	brd_free_snapshot(snap);
+	return 0;
+}
+
+/*
+ * Return the dirty bitmap to user space and clear it. Every word is
+ * fetched and cleared atomically, so no concurrent write gets lost.
+ */
+static int brd_get_dirty(struct brd_device *brd,
+			 struct brd_dirty_bitmap __user *uarg)
+{
+	struct brd_dirty_bitmap arg;
+	unsigned long nbits = brd->brd_dirty_bits;
+	unsigned long *dirty;
+	u64 *words;
+	unsigned long i;
+	int err = 0;
+
+	if (copy_from_user(&arg, uarg, sizeof(arg)))
+		return -EFAULT;
+	if (arg.nr_pages < nbits) {
+		arg.nr_pages = nbits;
+		if (copy_to_user(uarg, &arg, sizeof(arg)))
+			return -EFAULT;
+		return -EOVERFLOW;
+	}
+
+	dirty = bitmap_zalloc(nbits, GFP_KERNEL);
+	words = kvcalloc(BITS_TO_U64(nbits), sizeof(u64), GFP_KERNEL);
+	if (!dirty || !words) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < BITS_TO_LONGS(nbits); i++)
+		dirty[i] = xchg(&brd->brd_dirty[i], 0);
+	bitmap_to_arr64(words, dirty, nbits);
+
+	arg.nr_pages = nbits;
+	if (copy_to_user(u64_to_user_ptr(arg.bitmap), words,
+			 BITS_TO_U64(nbits) * sizeof(u64)) ||
+	    copy_to_user(uarg, &arg, sizeof(arg))) {
+		/* Put the bits back for the next caller */
+		for_each_set_bit(i, dirty, nbits)
+			set_bit(i, brd->brd_dirty);
+		err = -EFAULT;
+	}
+
+out:
+	kvfree(words);
+	bitmap_free(dirty);
+	return err;
+}
+
+/*
+ * Hash pages in the kernel, so that user space can compare and dedupe
+ * device images without reading them.
+ */
+static int brd_get_digests(struct brd_device *brd,
+			   struct brd_page_digests __user *uarg)
+{
+	struct brd_page_digests arg;
+	u64 __user *digests;
+	u64 nr_pages, end, i, zero_digest;
+
+	if (copy_from_user(&arg, uarg, sizeof(arg)))
+		return -EFAULT;
+	if (arg.flags & ~BRD_DIGEST_DIRTY)
+		return -EINVAL;
+
+	nr_pages = DIV_ROUND_UP(get_capacity(brd->brd_disk), PAGE_SECTORS);
+	if (arg.start > nr_pages)
+		return -EINVAL;
+	end = arg.start + min(arg.nr_pages, nr_pages - arg.start);
+	digests = u64_to_user_ptr(arg.digests);
+	zero_digest = xxh64(page_address(ZERO_PAGE(0)), PAGE_SIZE, arg.seed);
+
+	for (i = arg.start; i < end; i++) {
+		struct page *page;
+		u64 digest = zero_digest;
+
+		if ((arg.flags & BRD_DIGEST_DIRTY) &&
+		    !(i < brd->brd_dirty_bits && test_bit(i, brd->brd_dirty)))
+			continue;
+
+		/* Hold the page so that a concurrent discard cannot free it */
+		xa_lock(&brd->brd_pages);
+		page = xa_load(&brd->brd_pages, i);
+		if (page)
+			get_page(page);
+		xa_unlock(&brd->brd_pages);
+
+		if (page) {
+			void *src = kmap_local_page(page);
+
+			digest = xxh64(src, PAGE_SIZE, arg.seed);
+			kunmap_local(src);
+			brd_put_page(page);
+		}
+		if (put_user(digest, digests + (i - arg.start)))
+			return -EFAULT;
+		cond_resched();
+	}
+
+	arg.nr_pages = end - arg.start;
+	if (copy_to_user(uarg, &arg, sizeof(arg)))
+		return -EFAULT;
+	return 0;
+}
+
+static int brd_ioctl(struct block_device *bdev, blk_mode_t mode,
+		     unsigned int cmd, unsigned long arg)
+{
+	struct brd_device *brd = bdev->bd_disk->private_data;
+	struct brd_snapshot *snap;
+	int err;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	switch (cmd) {
+	case BRD_SNAPSHOT:
+	case BRD_RESTORE:
+	case BRD_DROP_SNAPSHOT:
+	case BRD_GET_DIRTY:
+	case BRD_GET_DIGESTS:
+	case BRD_COMPARE_WRITES:
+		break;
+	default:
+		return -ENOTTY;
+	}
+
+	/*
+	 * Write back the cached data first, so that the snapshot (or the
+	 * dirty bitmap) covers it and it is not written over the restored
+	 * pages later.
+	 */
+	err = sync_blockdev(bdev);
+	if (err)
+		return err;
+
+	mutex_lock(&brd->brd_snap_mutex);
+	switch (cmd) {
+	case BRD_SNAPSHOT:
+		err = brd_snapshot(brd, arg);
+		break;
+	case BRD_RESTORE:
+		err = brd_restore(brd, arg);
+		/* The page cache of the device is stale now */
+		invalidate_bdev(bdev);
+		break;
+	case BRD_DROP_SNAPSHOT:
+		snap = brd_find_snapshot(brd, arg);
+		err = -ENOENT;
+		if (snap) {
+			brd_free_snapshot(snap);
+			err = 0;
+		}
+		break;
+	case BRD_GET_DIRTY:
+		err = brd_get_dirty(brd, (void __user *)arg);
+		break;
+	case BRD_GET_DIGESTS:
+		err = brd_get_digests(brd, (void __user *)arg);
+		break;
+	case BRD_COMPARE_WRITES:
+		/* The writes cached before this call were flushed above */
+		WRITE_ONCE(brd->brd_compare_writes, arg != 0);
+		break;
+	}
+	mutex_unlock(&brd->brd_snap_mutex);
+
+	return err;
+}
+
 static const struct block_device_operations brd_fops = {
 	.owner =		THIS_MODULE,
 	.submit_bio =		brd_submit_bio,
+	.ioctl =		brd_ioctl,
 };
 
 /*
@@ -344,6 +858,8 @@ static int brd_alloc(int i)
 	list_add_tail(&brd->brd_list, &brd_devices);
 
 	xa_init(&brd->brd_pages);
+	mutex_init(&brd->brd_snap_mutex);
+	INIT_LIST_HEAD(&brd->brd_snapshots);
 
 	snprintf(buf, DISK_NAME_LEN, "ram%d", i);
 	if (!IS_ERR_OR_NULL(brd_debugfs_dir))
@@ -361,6 +877,16 @@ static int brd_alloc(int i)
 	disk->private_data	= brd;
 	strscpy(disk->disk_name, buf, DISK_NAME_LEN);
 	set_capacity(disk, get_ith_ramdisk_size(i) * 2);
+
+	/* Every page counts as dirty until the first BRD_GET_DIRTY */
+	brd->brd_dirty_bits = DIV_ROUND_UP(get_ith_ramdisk_size(i) * 2,
+					   PAGE_SECTORS);
+	brd->brd_dirty = bitmap_alloc(brd->brd_dirty_bits, GFP_KERNEL);
+	if (!brd->brd_dirty) {
+		err = -ENOMEM;
+		goto out_cleanup_disk;
+	}
+	bitmap_fill(brd->brd_dirty, brd->brd_dirty_bits);
 	
 	/*
 	 * This is so fdisk will align partitions on 4k, because of
@@ -371,6 +897,11 @@ static int brd_alloc(int i)
 	 */
 	blk_queue_physical_block_size(disk->queue, PAGE_SIZE);
 
+	/* Discard and write-zeroes free the pages they cover */
+	disk->queue->limits.discard_granularity = PAGE_SIZE;
+	blk_queue_max_discard_sectors(disk->queue, UINT_MAX);
+	blk_queue_max_write_zeroes_sectors(disk->queue, UINT_MAX);
+
 	/* Tell the block layer that this is not a rotational device */
 	blk_queue_flag_set(QUEUE_FLAG_NONROT, disk->queue);
 	blk_queue_flag_set(QUEUE_FLAG_SYNCHRONOUS, disk->queue);
@@ -382,6 +913,7 @@ static int brd_alloc(int i)
 	return 0;
 
 out_cleanup_disk:
+	bitmap_free(brd->brd_dirty);
 	put_disk(disk);
 out_free_dev:
 	list_del(&brd->brd_list);
@@ -401,12 +933,20 @@ static void brd_cleanup(void)
 	debugfs_remove_recursive(brd_debugfs_dir);
 
 	list_for_each_entry_safe(brd, next, &brd_devices, brd_list) {
+		struct brd_snapshot *snap, *snext;
+
 		del_gendisk(brd->brd_disk);
 		put_disk(brd->brd_disk);
+		list_for_each_entry_safe(snap, snext, &brd->brd_snapshots, list)
+			brd_free_snapshot(snap);
 		brd_free_pages(brd);
+		bitmap_free(brd->brd_dirty);
 		list_del(&brd->brd_list);
 		kfree(brd);
 	}
+
+	/* Pages freed by brd_put_page() must be gone before the module */
+	rcu_barrier();
 }
 
 static inline void brd_check_and_reset_par(void)
@@ -0,0 +1,71 @@
+/* SPDX-License-Identifier: GPL-2.0-only WITH Linux-syscall-note */
+/*
+ * ioctls of the modified brd driver, shared by the kernel module and the
+ * user space programs (e.g. the MCFS driver in fs-state/).
+ */
+
+#ifndef _BRD_IOCTL_H
+#define _BRD_IOCTL_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+#define BRD_IOC_CODE		0xbd
+
+/*
+ * Snapshot/restore the whole device.  The argument is the checkpoint id
+ * itself (not a pointer to it).  A snapshot shares its pages with the
+ * device copy-on-write, and BRD_RESTORE consumes the snapshot.  The
+ * device must not be mounted or written while these run.
+ */
+#define BRD_SNAPSHOT		_IO(BRD_IOC_CODE, 1)
+#define BRD_RESTORE		_IO(BRD_IOC_CODE, 2)
+#define BRD_DROP_SNAPSHOT	_IO(BRD_IOC_CODE, 3)
+
+/*
+ * Pages written since the last BRD_GET_DIRTY.  On input, nr_pages is the
+ * number of bits that the buffer at bitmap can hold; on output, it is the
+ * number of pages of the device (the call fails with EOVERFLOW if the
+ * buffer is too small).  Bit i of the __u64 word i / 64 stands for the
+ * i-th PAGE_SIZE page.  The bitmap is cleared as it is returned, and all
+ * pages are reported dirty by the first call.
+ */
+struct brd_dirty_bitmap {
+	__u64	nr_pages;
+	__u64	bitmap;		/* __u64 * in user space */
+};
+
+#define BRD_GET_DIRTY		_IOWR(BRD_IOC_CODE, 4, struct brd_dirty_bitmap)
+
+/*
+ * xxh64 digests of the pages [start, start + nr_pages), computed with the
+ * given seed.  digests[i] receives the digest of page start + i; pages that
+ * hold no memory have the digest of a zero page.  With BRD_DIGEST_DIRTY,
+ * only the pages that BRD_GET_DIRTY would report are hashed (without
+ * clearing their bits) and the other entries are left untouched.  On
+ * output, nr_pages is the number of pages covered, which is smaller than
+ * requested if the range goes past the end of the device.
+ */
+#define BRD_DIGEST_DIRTY	(1 << 0)
+
+struct brd_page_digests {
+	__u64	start;
+	__u64	nr_pages;
+	__u64	seed;
+	__u32	flags;
+	__u32	__pad;
+	__u64	digests;	/* __u64 * in user space */
+};
+
+#define BRD_GET_DIGESTS		_IOWR(BRD_IOC_CODE, 5, struct brd_page_digests)
+
+/*
+ * Compare the writes with the pages they overwrite (argument 1) or not
+ * (argument 0, the default).  While it is on, rewriting a page with the
+ * data it already holds does not make it dirty, at the cost of reading
+ * the page first.  MCFS turns it on only while SPIN restores the device
+ * images, which rewrite every page.  Cached writes are flushed first.
+ */
+#define BRD_COMPARE_WRITES	_IO(BRD_IOC_CODE, 6)
+
+#endif /* _BRD_IOCTL_H */
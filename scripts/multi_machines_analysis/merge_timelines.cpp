@@ -0,0 +1,363 @@
+/*
+ * Copyright (c) 2020-2024 Yifei Liu
+ * Copyright (c) 2020-2024 Wei Su
+ * Copyright (c) 2020-2024 Erez Zadok
+ * Copyright (c) 2020-2024 Stony Brook University
+ * Copyright (c) 2020-2024 The Research Foundation of SUNY
+ *
+ * You can redistribute it and/or modify it under the terms of the Apache
+ * License, Version 2.0 (http://www.apache.org/licenses/LICENSE-2.0).
+ */
+
+/*
+ * Streaming replacement of multi_analyze_all.py and swarm/analyze_all.py.
+ *
+ * Usage: merge_timelines [-m max_hours] [-i interval_secs] [-b] timeline...
+ *
+ * Each timeline holds the abstract states visited by one VT, in time order.
+ * It is either the text time-absfs-*.csv written by the extract scripts
+ * ("<secs>,<absfs hex>" per line), or a binary file of packed records
+ * { double secs; uint8_t absfs[16]; } in host byte order, with the absfs
+ * bytes in the order of the hex string (selected by -b or a .bin suffix).
+ *
+ * The timelines are merged by timestamp with a heap, which holds one record
+ * per VT, so the input is read once and only the set of unique states grows
+ * with the run.  The set keeps 16 bytes of key and 8 bytes per 64 VTs of
+ * metadata per state.
+ *
+ * One CSV row is printed at the end of every interval (default 3600s):
+ *   time_secs,total_all_states,total_unique_states,partial_overlap,
+ *   partial_waste_ratio,total_overlap,total_waste_ratio,
+ *   pan1_total_states,...,panN_total_states,
+ *   pan1_unique_states,...,panN_unique_states
+ * where partial_overlap is the number of states visited by two VTs or
+ * more, and total_overlap the number visited by all of them.  These are the
+ * columns of multi_analyze_all.py without the pairwise ones, which grow
+ * with the square of the number of VTs.  Without -m, rows are printed until
+ * all timelines are consumed.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <queue>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+struct state_key {
+  uint64_t lo;
+  uint64_t hi;
+};
+
+static inline bool key_empty(const state_key &k)
+{
+  return k.lo == 0 && k.hi == 0;
+}
+
+/*
+ * Open-addressed set of abstract states.  Each state keeps a bitmap of the
+ * VTs that visited it, so that the first visit of every VT is counted.
+ */
+class state_set {
+public:
+  state_set(int nvts)
+      : nvts(nvts), words((nvts + 63) / 64), keys(1 << 20),
+        vts((1 << 20) * words), used(0), has_zero(false), zero_vts(words),
+        unique(nvts, 0)
+  {
+  }
+
+  size_t size() const { return used + has_zero; }
+  /* States visited by two VTs or more */
+  size_t overlap() const { return shared; }
+  /* States visited by all the VTs */
+  size_t all_overlap() const { return by_all; }
+  /* States visited by the given VT */
+  uint64_t unique_of(int vt) const { return unique[vt]; }
+
+  void add(const state_key &k, int vt)
+  {
+    if (key_empty(k)) {
+      /* The all-zero key marks empty slots, so it is kept aside */
+      has_zero = true;
+      visit(zero_vts.data(), vt);
+      return;
+    }
+    if ((used + 1) * 4 > keys.size() * 3)
+      grow();
+    size_t i = slot_of(k);
+    if (key_empty(keys[i])) {
+      keys[i] = k;
+      used++;
+    }
+    visit(&vts[i * words], vt);
+  }
+
+private:
+  int nvts;
+  size_t words;
+  std::vector<state_key> keys;
+  std::vector<uint64_t> vts;
+  size_t used;
+  size_t shared = 0;
+  size_t by_all = 0;
+  bool has_zero;
+  std::vector<uint64_t> zero_vts;
+  std::vector<uint64_t> unique;
+
+  /* Record a visit of the VT to the state with the given bitmap */
+  void visit(uint64_t *bitmap, int vt)
+  {
+    uint64_t bit = 1ULL << (vt % 64);
+    if (bitmap[vt / 64] & bit)
+      return;
+    bitmap[vt / 64] |= bit;
+    unique[vt]++;
+    int nvisitors = 0;
+    for (size_t w = 0; w < words; ++w)
+      nvisitors += __builtin_popcountll(bitmap[w]);
+    if (nvisitors == 2)
+      shared++;
+    if (nvisitors == nvts)
+      by_all++;
+  }
+
+  size_t slot_of(const state_key &k) const
+  {
+    size_t mask = keys.size() - 1;
+    /* The keys are MD5/xxHash digests already, so no further mixing */
+    size_t i = (k.lo ^ k.hi) & mask;
+    while (!key_empty(keys[i]) && (keys[i].lo != k.lo || keys[i].hi != k.hi))
+      i = (i + 1) & mask;
+    return i;
+  }
+
+  void grow()
+  {
+    std::vector<state_key> old_keys(keys.size() * 2);
+    std::vector<uint64_t> old_vts(vts.size() * 2);
+    old_keys.swap(keys);
+    old_vts.swap(vts);
+    for (size_t j = 0; j < old_keys.size(); ++j) {
+      if (key_empty(old_keys[j]))
+        continue;
+      size_t i = slot_of(old_keys[j]);
+      keys[i] = old_keys[j];
+      std::copy(&old_vts[j * words], &old_vts[(j + 1) * words],
+                &vts[i * words]);
+    }
+  }
+};
+
+static int hexval(char c)
+{
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+/* Abstract states longer than 128 bits (several file systems) are folded */
+static bool parse_key(const char *s, state_key *k)
+{
+  uint64_t words[2] = {0, 0};
+  int nibbles = 0;
+  k->lo = k->hi = 0;
+  for (; *s && *s != '\n' && *s != '\r'; ++s) {
+    int v = hexval(*s);
+    if (v < 0)
+      return false;
+    uint64_t &w = words[(nibbles / 16) % 2];
+    w = (w << 4) | v;
+    if (++nibbles % 32 == 0) {
+      k->hi = (k->hi << 7 | k->hi >> 57) ^ words[0];
+      k->lo = (k->lo << 7 | k->lo >> 57) ^ words[1];
+      words[0] = words[1] = 0;
+    }
+  }
+  if (nibbles % 32 != 0) {
+    k->hi = (k->hi << 7 | k->hi >> 57) ^ words[0];
+    k->lo = (k->lo << 7 | k->lo >> 57) ^ words[1];
+  }
+  return nibbles > 0;
+}
+
+struct binary_record {
+  double secs;
+  uint8_t absfs[16];
+} __attribute__((packed));
+
+class timeline {
+public:
+  timeline(const char *path, bool binary)
+      : path(path), binary(binary), line(nullptr), linecap(0), lineno(0)
+  {
+    fp = fopen(path, binary ? "rb" : "r");
+    if (!fp) {
+      fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+      exit(1);
+    }
+    setvbuf(fp, nullptr, _IOFBF, 1 << 20);
+  }
+
+  ~timeline()
+  {
+    fclose(fp);
+    free(line);
+  }
+
+  /* Read the next record; false at the end of the timeline */
+  bool next(double *secs, state_key *k)
+  {
+    if (binary) {
+      binary_record rec;
+      size_t n = fread(&rec, sizeof(rec), 1, fp);
+      if (n != 1)
+        return false;
+      /* Same key as the hex string of the text format */
+      *secs = rec.secs;
+      k->hi = k->lo = 0;
+      for (int i = 0; i < 8; ++i) {
+        k->hi = (k->hi << 8) | rec.absfs[i];
+        k->lo = (k->lo << 8) | rec.absfs[i + 8];
+      }
+      return true;
+    }
+    while (getline(&line, &linecap, fp) >= 0) {
+      lineno++;
+      char *comma = strchr(line, ',');
+      if (comma && parse_key(comma + 1, k)) {
+        *secs = strtod(line, nullptr);
+        return true;
+      }
+      fprintf(stderr, "%s:%zu: skipping malformed line\n", path.c_str(),
+              lineno);
+    }
+    return false;
+  }
+
+private:
+  std::string path;
+  bool binary;
+  FILE *fp;
+  char *line;
+  size_t linecap;
+  size_t lineno;
+};
+
+struct head {
+  double secs;
+  state_key key;
+  int vt;
+
+  bool operator>(const head &other) const { return secs > other.secs; }
+};
+
+static bool has_suffix(const char *s, const char *suffix)
+{
+  size_t n = strlen(s), m = strlen(suffix);
+  return n >= m && strcmp(s + n - m, suffix) == 0;
+}
+
+static void print_row(double end_secs, const state_set &states,
+                      const std::vector<uint64_t> &totals)
+{
+  uint64_t all = 0;
+  for (uint64_t t : totals)
+    all += t;
+  size_t unique = states.size();
+  printf("%.0f,%" PRIu64 ",%zu,%zu,%.6f,%zu,%.6f", end_secs, all, unique,
+         states.overlap(), unique ? (double)states.overlap() / unique : 0.0,
+         states.all_overlap(),
+         unique ? (double)states.all_overlap() / unique : 0.0);
+  for (uint64_t t : totals)
+    printf(",%" PRIu64, t);
+  for (size_t i = 0; i < totals.size(); ++i)
+    printf(",%" PRIu64, states.unique_of(i));
+  printf("\n");
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr, "Usage: %s [-m max_hours] [-i interval_secs] [-b] "
+          "timeline...\n", prog);
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  int max_hours = 0;
+  double interval = 3600;
+  bool force_binary = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "m:i:b")) != -1) {
+    switch (opt) {
+    case 'm':
+      max_hours = atoi(optarg);
+      break;
+    case 'i':
+      interval = strtod(optarg, nullptr);
+      break;
+    case 'b':
+      force_binary = true;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  int nvts = argc - optind;
+  if (nvts < 1 || interval <= 0)
+    usage(argv[0]);
+
+  std::vector<timeline *> timelines;
+  std::priority_queue<head, std::vector<head>, std::greater<head>> heap;
+  for (int i = 0; i < nvts; ++i) {
+    const char *path = argv[optind + i];
+    timelines.push_back(new timeline(path,
+                                     force_binary || has_suffix(path, ".bin")));
+    head h;
+    h.vt = i;
+    if (timelines[i]->next(&h.secs, &h.key))
+      heap.push(h);
+  }
+
+  printf("time_secs,total_all_states,total_unique_states,partial_overlap,"
+         "partial_waste_ratio,total_overlap,total_waste_ratio");
+  for (int i = 1; i <= nvts; ++i)
+    printf(",pan%d_total_states", i);
+  for (int i = 1; i <= nvts; ++i)
+    printf(",pan%d_unique_states", i);
+  printf("\n");
+
+  state_set states(nvts);
+  std::vector<uint64_t> totals(nvts, 0);
+  double end_secs = interval;
+  double max_secs = max_hours > 0 ? max_hours * 3600.0 : INFINITY;
+  while (end_secs <= max_secs) {
+    while (!heap.empty() && heap.top().secs <= end_secs) {
+      head h = heap.top();
+      heap.pop();
+      states.add(h.key, h.vt);
+      totals[h.vt]++;
+      if (timelines[h.vt]->next(&h.secs, &h.key))
+        heap.push(h);
+    }
+    print_row(end_secs, states, totals);
+    if (heap.empty() && max_hours <= 0)
+      break;
+    end_secs += interval;
+  }
+
+  for (timeline *t : timelines)
+    delete t;
+  return 0;
+}
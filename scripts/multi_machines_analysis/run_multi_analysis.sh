@@ -120,4 +120,9 @@ done
 
 ################ Part 5: Perform analysis 
 
-./multi_analyze_all.py -m 147 -n 18 > results-yifeilatest345-Overall-VT18-each6-147hours-2023-1012.csv
+## merge_timelines streams all timelines in one pass with bounded memory;
+## multi_analyze_all.py also reports the pairwise overlaps but keeps every
+## state of every VT in Python sets.
+make merge_timelines
+./merge_timelines -m 147 $(ls time-absfs-$MASTER-VT$TOTVM-pan*.csv | sort -V) > results-yifeilatest345-Overall-VT18-each6-147hours-2023-1012.csv
+# ./multi_analyze_all.py -m 147 -n 18 > results-yifeilatest345-Overall-VT18-each6-147hours-2023-1012.csv
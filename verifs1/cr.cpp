@@ -9,32 +9,345 @@
  * License, Version 2.0 (http://www.apache.org/licenses/LICENSE-2.0).
  */
 
-#include <unordered_map>
+#include <map>
+#include <string>
+#include <vector>
 #include <cstdint>
 #include <cerrno>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "cr.h"
 #include "crmfs.h"
 
-std::unordered_map<uint64_t, void *> state_pool;
+/* A saved state is either resident (ptr != nullptr) or has been spilled
+ * to spill_path by the spill policy below. */
+struct saved_state {
+  void *ptr;
+  size_t nbytes;
+  std::string spill_path;
+};
 
-int insert_state(uint64_t key, void *ptr)
+/* Ordered by key: the driver uses the DFS depth as the key, so the
+ * smallest keys are the checkpoints buried deepest in the stack, which
+ * will be the last ones to be restored. */
+static std::map<uint64_t, saved_state> state_pool;
+static size_t pool_icap;
+/* Bytes held by resident states */
+static size_t pool_bytes;
+/* Bytes held by all states, resident or spilled */
+static size_t total_bytes;
+/* 0 means unlimited, i.e., never spill */
+static size_t pool_budget;
+/* Hard cap of resident bytes; 0 means unlimited */
+static size_t pool_max;
+static std::string spill_dir = CRM_DEFAULT_SPILL_DIR;
+
+struct pickle_header {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t nrecords;
+  uint64_t icap;
+  /* Offset of the data region from the beginning of the file */
+  uint64_t data_off;
+  uint64_t data_size;
+};
+
+struct pickle_record {
+  uint64_t slot;
+  /* Offset of the file data relative to the data region */
+  uint64_t data_off;
+  struct crmfs_file file;
+};
+
+size_t file_table_bytes(const struct crmfs_file *table, size_t icap)
+{
+  size_t total = icap * sizeof(struct crmfs_file);
+  for (size_t i = 0; i < icap; ++i) {
+    total += CRM_FILE_ATTR(&table[i], blocks) * CRM_BLOCK_SZ;
+  }
+  return total;
+}
+
+void free_file_table(struct crmfs_file *table, size_t icap)
+{
+  if (table == nullptr)
+    return;
+  for (size_t i = 0; i < icap; ++i) {
+    free(table[i].data);
+  }
+  free(table);
+}
+
+/* Deep copy of an inode table, or NULL if out of memory */
+struct crmfs_file *copy_file_table(const struct crmfs_file *table,
+                                   size_t icap)
+{
+  struct crmfs_file *copy =
+      (struct crmfs_file *)malloc(icap * sizeof(struct crmfs_file));
+  if (!copy)
+    return nullptr;
+  memcpy(copy, table, icap * sizeof(struct crmfs_file));
+  /* Reset the pointers, so that a partial copy can be freed */
+  for (size_t i = 0; i < icap; ++i) {
+    copy[i].data = nullptr;
+  }
+  for (size_t i = 0; i < icap; ++i) {
+    size_t datasz = CRM_FILE_ATTR(&table[i], blocks) * CRM_BLOCK_SZ;
+    if (datasz == 0)
+      continue;
+    copy[i].data = malloc(datasz);
+    if (!copy[i].data) {
+      free_file_table(copy, icap);
+      return nullptr;
+    }
+    memcpy(copy[i].data, table[i].data, datasz);
+  }
+  return copy;
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+  const char *p = (const char *)buf;
+  while (len > 0) {
+    ssize_t n = write(fd, p, len);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -errno;
+    }
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/*
+ * The pickle is laid out so that it can be mmap'ed and used in place:
+ *
+ *   [pickle_header][pickle_record x nrecords][data region]
+ *
+ * Only slots in use are recorded, and the data pointer of each record is
+ * replaced by an offset into the data region.
+ */
+int pickle_files(const char *path, const struct crmfs_file *table,
+                 size_t icap)
+{
+  std::vector<pickle_record> records;
+  uint64_t data_size = 0;
+  for (size_t i = 0; i < icap; ++i) {
+    if (!(table[i].flag & CRM_FILE_EXIST))
+      continue;
+    pickle_record rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.slot = i;
+    rec.data_off = data_size;
+    rec.file = table[i];
+    rec.file.data = nullptr;
+    records.push_back(rec);
+    data_size += CRM_FILE_ATTR(&table[i], blocks) * CRM_BLOCK_SZ;
+  }
+
+  pickle_header hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  hdr.magic = CRM_PICKLE_MAGIC;
+  hdr.version = CRM_PICKLE_VERSION;
+  hdr.nrecords = records.size();
+  hdr.icap = icap;
+  hdr.data_off = sizeof(hdr) + records.size() * sizeof(pickle_record);
+  hdr.data_size = data_size;
+
+  int fd = open(path, O_CREAT | O_WRONLY | O_TRUNC, 0600);
+  if (fd < 0)
+    return -errno;
+  int ret = write_all(fd, &hdr, sizeof(hdr));
+  if (ret == 0)
+    ret = write_all(fd, records.data(), records.size() * sizeof(pickle_record));
+  for (size_t i = 0; ret == 0 && i < records.size(); ++i) {
+    const struct crmfs_file *f = &table[records[i].slot];
+    size_t datasz = CRM_FILE_ATTR(f, blocks) * CRM_BLOCK_SZ;
+    if (datasz > 0)
+      ret = write_all(fd, f->data, datasz);
+  }
+  if (close(fd) != 0 && ret == 0)
+    ret = -errno;
+  if (ret != 0)
+    unlink(path);
+  return ret;
+}
+
+struct crmfs_file *load_files(const char *path, size_t icap)
+{
+  struct crmfs_file *table = nullptr;
+  struct stat st;
+  void *map = MAP_FAILED;
+  long ret = 0;
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return (struct crmfs_file *)ERR_PTR(-errno);
+  if (fstat(fd, &st) != 0) {
+    ret = -errno;
+    goto out;
+  }
+  if ((size_t)st.st_size < sizeof(pickle_header)) {
+    ret = -EINVAL;
+    goto out;
+  }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED) {
+    ret = -errno;
+    goto out;
+  }
+
+  {
+    const char *base = (const char *)map;
+    const pickle_header *hdr = (const pickle_header *)base;
+    const pickle_record *records = (const pickle_record *)(hdr + 1);
+    if (hdr->magic != CRM_PICKLE_MAGIC || hdr->version != CRM_PICKLE_VERSION ||
+        hdr->icap != icap || hdr->nrecords > icap ||
+        hdr->data_off != sizeof(*hdr) + hdr->nrecords * sizeof(pickle_record) ||
+        hdr->data_off + hdr->data_size != (uint64_t)st.st_size) {
+      ret = -EINVAL;
+      goto out;
+    }
+    table = (struct crmfs_file *)calloc(icap, sizeof(struct crmfs_file));
+    if (!table) {
+      ret = -ENOMEM;
+      goto out;
+    }
+    for (uint32_t i = 0; i < hdr->nrecords; ++i) {
+      const pickle_record *rec = &records[i];
+      size_t datasz = CRM_FILE_ATTR(&rec->file, blocks) * CRM_BLOCK_SZ;
+      if (rec->slot >= icap || rec->data_off + datasz > hdr->data_size) {
+        ret = -EINVAL;
+        goto out;
+      }
+      struct crmfs_file *f = &table[rec->slot];
+      *f = rec->file;
+      f->data = nullptr;
+      if (datasz == 0)
+        continue;
+      f->data = malloc(datasz);
+      if (!f->data) {
+        ret = -ENOMEM;
+        goto out;
+      }
+      memcpy(f->data, base + hdr->data_off + rec->data_off, datasz);
+    }
+  }
+
+out:
+  if (map != MAP_FAILED)
+    munmap(map, st.st_size);
+  close(fd);
+  if (ret != 0) {
+    free_file_table(table, icap);
+    return (struct crmfs_file *)ERR_PTR(ret);
+  }
+  return table;
+}
+
+static std::string spill_path_of(uint64_t key)
+{
+  return spill_dir + "/crmfs-" + std::to_string(getpid()) + "-state-" +
+         std::to_string(key) + ".pkl";
+}
+
+static bool pool_fits(size_t nbytes)
+{
+  return (pool_budget == 0 || pool_bytes + nbytes <= pool_budget) &&
+         (pool_max == 0 || pool_bytes + nbytes <= pool_max);
+}
+
+/*
+ * Make room for nbytes more resident bytes.  If spilling is enabled, the
+ * coldest resident states are spilled until they fit in the budget and the
+ * hard cap.  Fails with -ENOSPC if the cap still cannot take them.  Both
+ * new checkpoints and reloads of spilled states go through here.
+ */
+int state_pool_make_room(size_t nbytes)
+{
+  for (auto it = state_pool.begin();
+       pool_budget != 0 && !pool_fits(nbytes) && it != state_pool.end();
+       ++it) {
+    saved_state &st = it->second;
+    if (st.ptr == nullptr)
+      continue;
+    std::string path = spill_path_of(it->first);
+    int ret = pickle_files(path.c_str(), (struct crmfs_file *)st.ptr,
+                           pool_icap);
+    if (ret != 0) {
+      fprintf(stderr, "%s: cannot spill state %lu to %s (%d)\n", __func__,
+              (unsigned long)it->first, path.c_str(), ret);
+      break;
+    }
+    free_file_table((struct crmfs_file *)st.ptr, pool_icap);
+    st.ptr = nullptr;
+    st.spill_path = path;
+    pool_bytes -= st.nbytes;
+  }
+  if (pool_max != 0 && pool_bytes + nbytes > pool_max)
+    return -ENOSPC;
+  return 0;
+}
+
+void state_pool_init(size_t icap)
+{
+  const char *budget = getenv(CRM_POOL_BUDGET_ENV);
+  const char *dir = getenv(CRM_SPILL_DIR_ENV);
+  const char *max = getenv(CRM_POOL_MAX_ENV);
+  pool_icap = icap;
+  if (budget)
+    pool_budget = strtoull(budget, NULL, 10) * 1024 * 1024;
+  if (max)
+    pool_max = strtoull(max, NULL, 10) * 1024 * 1024;
+  if (dir)
+    spill_dir = dir;
+}
+
+int insert_state(uint64_t key, void *ptr, size_t nbytes)
 {
   auto it = state_pool.find(key);
   if (it != state_pool.end()) {
     return -EEXIST;
   }
-  state_pool.insert({key, ptr});
+  int ret = state_pool_make_room(nbytes);
+  if (ret != 0) {
+    return ret;
+  }
+  state_pool.insert({key, {ptr, nbytes, std::string()}});
+  pool_bytes += nbytes;
+  total_bytes += nbytes;
   return 0;
 }
 
+/* NULL if there is no such state, or an ERR_PTR() if a spilled state
+ * cannot be brought back */
 void *find_state(uint64_t key)
 {
   auto it = state_pool.find(key);
   if (it == state_pool.end()) {
     return nullptr;
-  } else {
-    return it->second;
   }
+  saved_state &st = it->second;
+  if (st.ptr == nullptr) {
+    /* Bring a spilled state back into memory */
+    int ret = state_pool_make_room(st.nbytes);
+    if (ret != 0) {
+      return ERR_PTR(ret);
+    }
+    struct crmfs_file *table = load_files(st.spill_path.c_str(), pool_icap);
+    if (IS_ERR(table)) {
+      fprintf(stderr, "%s: cannot load state %lu from %s (%ld)\n", __func__,
+              (unsigned long)key, st.spill_path.c_str(), PTR_ERR(table));
+      return table;
+    }
+    unlink(st.spill_path.c_str());
+    st.spill_path.clear();
+    st.ptr = table;
+    pool_bytes += st.nbytes;
+  }
+  return st.ptr;
 }
 
 int remove_state(uint64_t key)
@@ -43,6 +356,20 @@ int remove_state(uint64_t key)
   if (it == state_pool.end()) {
     return -ENOENT;
   }
+  if (it->second.ptr == nullptr) {
+    unlink(it->second.spill_path.c_str());
+  } else {
+    pool_bytes -= it->second.nbytes;
+  }
+  total_bytes -= it->second.nbytes;
   state_pool.erase(it);
   return 0;
 }
+
+void state_pool_stat(struct verifs_pool_stat *st)
+{
+  st->nstates = state_pool.size();
+  st->nbytes = total_bytes;
+  st->resident_bytes = pool_bytes;
+  st->max_bytes = pool_max;
+}
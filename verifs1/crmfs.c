@@ -9,8 +9,11 @@
  * License, Version 2.0 (http://www.apache.org/licenses/LICENSE-2.0).
  */
 
+#define _GNU_SOURCE
+#include "abstract_fs.h"
 #include "crmfs.h"
 
+#include <sys/uio.h>
 #include "custom_heap.h"
 
 static size_t icap;
@@ -20,6 +23,13 @@ static struct fuse_session *crmfs_se;
 static const unsigned long crmfs_magic = 0xf09f90b120e596b5;
 struct crmfs_file *files;
 pthread_mutex_t global_lk;
+/* Reply buffer of readdir, one per thread, reused across calls and only
+ * grown.  Threads that exit free theirs through the key destructor. */
+struct readdir_buf {
+    char *data;
+    size_t size;
+};
+static pthread_key_t readdir_buf_key;
 
 static void crmfs_lock(const char *caller)
 {
@@ -301,21 +311,60 @@ static struct crmfs_file *crmfs_iget(fuse_ino_t ino)
     return file;
 }
 
+static void free_readdir_buf(void *ptr)
+{
+    struct readdir_buf *buf = ptr;
+    free(buf->data);
+    free(buf);
+}
+
+/* The readdir buffer of the calling thread, at least size bytes long */
+static struct readdir_buf *get_readdir_buf(size_t size)
+{
+    struct readdir_buf *buf = pthread_getspecific(readdir_buf_key);
+    if (!buf) {
+        buf = calloc(1, sizeof(struct readdir_buf));
+        if (!buf)
+            return NULL;
+        if (pthread_setspecific(readdir_buf_key, buf) != 0) {
+            free(buf);
+            return NULL;
+        }
+    }
+    if (buf->size < size) {
+        char *newdata = realloc(buf->data, size);
+        if (newdata == NULL)
+            return NULL;
+        buf->data = newdata;
+        buf->size = size;
+    }
+    return buf;
+}
+
 static void crmfs_init(void *userdata, struct fuse_conn_info *conn)
 {
     enter();
     icap = CRM_DEFAULT_ICAP;
     dcap = 0;
     files = calloc(icap, sizeof(struct crmfs_file));
+    state_pool_init(icap);
+    int ret = pthread_key_create(&readdir_buf_key, free_readdir_buf);
+    assert(ret == 0);
     /* Create the first inode (root directory) */
     mode_t rootmode = 0777 & (~get_umask());
     struct crmfs_file *root = crmfs_file_create(__S_IFDIR, rootmode, getuid(),
                                                 getgid());
     assert(root != NULL);
-    int ret = crmfs_populate_dir(root, root);
+    ret = crmfs_populate_dir(root, root);
     assert(ret == 0);
     /* Enable ioctl on directory */
     conn->want |= FUSE_CAP_IOCTL_DIR;
+    /* Let the kernel splice write payloads to us and take read replies
+     * without an intermediate copy when it is able to */
+    if (conn->capable & FUSE_CAP_SPLICE_READ)
+        conn->want |= FUSE_CAP_SPLICE_READ;
+    if (conn->capable & FUSE_CAP_SPLICE_WRITE)
+        conn->want |= FUSE_CAP_SPLICE_WRITE;
 }
 
 static void crmfs_destroy(void *userdata)
@@ -329,6 +378,14 @@ static void crmfs_destroy(void *userdata)
     }
     free(files);
     files = NULL;
+    /* The other worker threads have exited by now, and with them their
+     * readdir buffers; only the one of this thread is left */
+    struct readdir_buf *buf = pthread_getspecific(readdir_buf_key);
+    if (buf) {
+        pthread_setspecific(readdir_buf_key, NULL);
+        free_readdir_buf(buf);
+    }
+    pthread_key_delete(readdir_buf_key);
 }
 
 static void crmfs_lookup(fuse_req_t req, fuse_ino_t parent_ino, const char *name)
@@ -477,13 +534,14 @@ static void crmfs_read_dir(fuse_req_t req, fuse_ino_t ino, size_t size,
         fuse_reply_buf(req, NULL, 0);
         goto end;
     }
-    char *buffer = malloc(size);
-    size_t bytes_added = 0;
-    off_t i;
-    if (buffer == NULL) {
+    struct readdir_buf *buf = get_readdir_buf(size);
+    if (buf == NULL) {
         fuse_reply_err(req, ENOMEM);
         goto end;
     }
+    char *buffer = buf->data;
+    size_t bytes_added = 0;
+    off_t i;
 
     /* Fill the buffer with dir entries */
     for (i = off; i < table->capacity; ++i) {
@@ -505,7 +563,6 @@ static void crmfs_read_dir(fuse_req_t req, fuse_ino_t ino, size_t size,
     }
 
     fuse_reply_buf(req, buffer, bytes_added);
-    free(buffer);
 end:
     crmfs_unlock(__func__);
 }
@@ -700,10 +757,12 @@ end:
     crmfs_unlock(__func__);
 }
 
-static void crmfs_write(fuse_req_t req, fuse_ino_t ino, const char *buf,
-                        size_t size, off_t off, struct fuse_file_info *fi)
+static void crmfs_write_buf(fuse_req_t req, fuse_ino_t ino,
+                            struct fuse_bufvec *in_buf, off_t off,
+                            struct fuse_file_info *fi)
 {
     enter();
+    size_t size = fuse_buf_size(in_buf);
     crmfs_lock(__func__);
     struct crmfs_file *file = crmfs_iget(ino);
     if (!file) {
@@ -721,9 +780,16 @@ static void crmfs_write(fuse_req_t req, fuse_ino_t ino, const char *buf,
         goto end;
     }
 
-    char *p = file->data + off;
-    memcpy(p, buf, size);
-    fuse_reply_write(req, size);
+    /* Copy (or splice, if in_buf is backed by a pipe) straight into the
+     * file data */
+    struct fuse_bufvec out_buf = FUSE_BUFVEC_INIT(size);
+    out_buf.buf[0].mem = (char *)file->data + off;
+    ssize_t copied = fuse_buf_copy(&out_buf, in_buf, 0);
+    if (copied < 0) {
+        fuse_reply_err(req, -copied);
+        goto end;
+    }
+    fuse_reply_write(req, copied);
 end:
     crmfs_unlock(__func__);
 }
@@ -755,16 +821,18 @@ static void crmfs_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
 
     size_t filesize = CRM_FILE_ATTR(file, size);
     size_t bytes_read;
-    char *p = file->data;
     if (off >= filesize) {
-        fuse_reply_buf(req, p, 0);
+        fuse_reply_buf(req, NULL, 0);
         goto end;
     } else if (off + size > filesize) {
         bytes_read = filesize - off;
     } else {
         bytes_read = size;
     }
-    fuse_reply_buf(req, p + off, bytes_read);
+    /* Reply straight from the file data; libfuse may splice it */
+    struct fuse_bufvec out_buf = FUSE_BUFVEC_INIT(bytes_read);
+    out_buf.buf[0].mem = (char *)file->data + off;
+    fuse_reply_data(req, &out_buf, 0);
 end:
     crmfs_unlock(__func__);
 }
@@ -860,48 +928,25 @@ static void crmfs_statfs(fuse_req_t req, fuse_ino_t ino)
 
 static void free_files(struct crmfs_file *files_)
 {
-    if (files_ == NULL)
-        return;
-    for (size_t i = 0; i < icap; ++i) {
-        if (files_[i].data) {
-            free(files_[i].data);
-        }
-    }
-    free(files_);
+    free_file_table(files_, icap);
 }
 
 static int checkpoint(uint64_t key)
 {
     enter();
     crmfs_lock(__func__);
-    size_t inodes_size = icap * sizeof(struct crmfs_file);
-    struct crmfs_file *copied_files = malloc(inodes_size);
-    int ret = 0;
+    struct crmfs_file *copied_files = NULL;
+    /* Fail before copying anything if the pool cannot take the state */
+    int ret = state_pool_make_room(file_table_bytes(files, icap));
+    if (ret != 0)
+        goto err;
+    copied_files = copy_file_table(files, icap);
     if (!copied_files) {
         ret = -ENOMEM;
         goto err;
     }
-    memcpy(copied_files, files, inodes_size);
-    /* Reset the pointers */
-    for (size_t i = 0; i < icap; ++i) {
-        copied_files[i].data = NULL;
-    }
-    /* Deep copy the data */
-    for (size_t i = 0; i < icap; ++i) {
-        size_t datasz = CRM_FILE_ATTR(&files[i], blocks) * CRM_BLOCK_SZ;
-        if (datasz == 0) {
-            continue;
-        }
-        char *fdata = malloc(datasz);
-        if (!fdata) {
-            ret = -ENOMEM;
-            goto err;
-        }
-        memcpy(fdata, files[i].data, datasz);
-        copied_files[i].data = fdata;
-    }
 
-    ret = insert_state(key, copied_files);
+    ret = insert_state(key, copied_files, file_table_bytes(copied_files, icap));
     if (ret != 0)
         goto err;
 
@@ -947,31 +992,20 @@ static int restore(uint64_t key)
         ret = -ENOENT;
         goto err;
     }
+    if (IS_ERR(stored_files)) {
+        ret = PTR_ERR(stored_files);
+        goto err;
+    }
 
     invalidate_kernel_states();
-    size_t itable_sz = icap * sizeof(struct crmfs_file);
     /* Make a full copy of the stored inode table.
      * We only perfrom the table replacement if the entire
      * deep copying process is successful. */
-    newfiles = malloc(itable_sz);
+    newfiles = copy_file_table(stored_files, icap);
     if (!newfiles) {
         ret = -ENOMEM;
         goto err;
     }
-    memcpy(newfiles, stored_files, itable_sz);
-    for (size_t i = 0; i < icap; ++i) {
-        newfiles[i].data = NULL;
-    }
-    for (size_t i = 0; i < icap; ++i) {
-        size_t dsize = CRM_FILE_ATTR(&newfiles[i], blocks) * CRM_BLOCK_SZ;
-        char *fdata = malloc(dsize);
-        if (!fdata) {
-            ret = -ENOMEM;
-            goto err;
-        }
-        memcpy(fdata, stored_files[i].data, dsize);
-        newfiles[i].data = fdata;
-    }
     /* Free the current inode table and replace it with the
      * copy retrieved from above code */
     free_files(files);
@@ -987,6 +1021,171 @@ err:
     return ret;
 }
 
+struct absfs_entry {
+    char *path;
+    struct crmfs_file *file;
+};
+
+static int absfs_entry_cmp(const void *a, const void *b)
+{
+    const struct absfs_entry *ea = a;
+    const struct absfs_entry *eb = b;
+    return strcmp(ea->path, eb->path);
+}
+
+/* Collect the files under dir the same way nftw(FTW_PHYS) would see them
+ * on the mount point */
+static int absfs_collect(struct crmfs_file *dir, const char *dirpath,
+                         struct absfs_entry *entries, size_t *n)
+{
+    struct crmfs_dirtable *table = dir->data;
+    for (size_t i = 0; i < table->capacity; ++i) {
+        struct crmfs_dirent *dirent = &table->dirents[i];
+        if (dirent->ino == 0 || strncmp(dirent->name, ".", NAME_MAX) == 0 ||
+            strncmp(dirent->name, "..", NAME_MAX) == 0)
+            continue;
+        struct crmfs_file *child = crmfs_iget(dirent->ino);
+        if (!child)
+            continue;
+        char path[PATH_MAX];
+        snprintf(path, PATH_MAX, "%s/%.*s",
+                 (strcmp(dirpath, "/") == 0) ? "" : dirpath,
+                 (int)strnlen(dirent->name, NAME_MAX), dirent->name);
+        if (absfs_is_excluded(path))
+            continue;
+        /* No hard links, so every inode shows up at most once */
+        if (*n >= icap)
+            return -EOVERFLOW;
+        entries[*n].path = strdup(path);
+        if (!entries[*n].path)
+            return -ENOMEM;
+        entries[*n].file = child;
+        (*n)++;
+        if (S_ISDIR(CRM_FILE_MODE(child))) {
+            int ret = absfs_collect(child, path, entries, n);
+            if (ret)
+                return ret;
+        }
+    }
+    return 0;
+}
+
+/* Compute the abstract state straight from the inode table. This must
+ * produce the same result as scan_abstract_fs() on the mount point. */
+static int abstract_state(struct verifs_absfs *arg)
+{
+    enter();
+    absfs_t absfs;
+    struct absfs_entry *entries = NULL;
+    size_t n = 0;
+    int ret = 0;
+
+    if (arg->hash_option > crc32_t)
+        return -EINVAL;
+    crmfs_lock(__func__);
+    entries = calloc(icap, sizeof(struct absfs_entry));
+    if (!entries) {
+        ret = -ENOMEM;
+        goto end;
+    }
+    struct crmfs_file *root = crmfs_iget(FUSE_ROOT_ID);
+    if (!root) {
+        ret = -ENOENT;
+        goto end;
+    }
+    entries[n].path = strdup("/");
+    if (!entries[n].path) {
+        ret = -ENOMEM;
+        goto end;
+    }
+    entries[n++].file = root;
+    ret = absfs_collect(root, "/", entries, &n);
+    if (ret)
+        goto end;
+    qsort(entries, n, sizeof(struct absfs_entry), absfs_entry_cmp);
+
+    absfs.hash_option = arg->hash_option;
+    init_abstract_fs(&absfs);
+    for (size_t i = 0; i < n; ++i) {
+        struct crmfs_file *f = entries[i].file;
+        struct absfs_attrs attrs = {
+            .mode = CRM_FILE_MODE(f),
+            .size = CRM_FILE_SIZE(f),
+            .nlink = CRM_FILE_ATTR(f, nlink),
+            .uid = CRM_FILE_ATTR(f, uid),
+            .gid = CRM_FILE_ATTR(f, gid),
+        };
+        /* VeriFS1 has no symlinks, so there is no target path */
+        absfs_feed_file(&absfs, entries[i].path, "", &attrs);
+        if (S_ISREG(attrs.mode) && attrs.size > 0)
+            absfs_feed_content(&absfs, f->data, attrs.size);
+    }
+    ret = (digest_abstract_fs(&absfs) == 0) ? 0 : -EINVAL;
+    memcpy(arg->state, absfs.state, sizeof(arg->state));
+    destroy_abstract_fs(&absfs);
+end:
+    if (entries) {
+        for (size_t i = 0; i < n; ++i)
+            free(entries[i].path);
+        free(entries);
+    }
+    crmfs_unlock(__func__);
+    return ret;
+}
+
+/* Serialize the live inode table to the file at path */
+static int pickle(const char *path)
+{
+    enter();
+    crmfs_lock(__func__);
+    int ret = pickle_files(path, files, icap);
+    crmfs_unlock(__func__);
+    return ret;
+}
+
+/* Replace the live inode table with the one pickled at path */
+static int load(const char *path)
+{
+    enter();
+    crmfs_lock(__func__);
+    struct crmfs_file *newfiles = load_files(path, icap);
+    if (IS_ERR(newfiles)) {
+        crmfs_unlock(__func__);
+        return PTR_ERR(newfiles);
+    }
+    invalidate_kernel_states();
+    free_files(files);
+    files = newfiles;
+    crmfs_unlock(__func__);
+    return 0;
+}
+
+/*
+ * The ioctl argument of VERIFS_PICKLE and VERIFS_LOAD is a struct verifs_str
+ * whose str points into the caller's memory.  FUSE only copies the struct
+ * itself into in_buf (restricted ioctl), so we fetch the string from the
+ * address space of the calling process.
+ */
+static int read_caller_str(fuse_req_t req, const void *in_buf,
+                           size_t in_bufsz, char *buf, size_t bufsz)
+{
+    const struct verifs_str *vstr = in_buf;
+    if (in_bufsz < sizeof(struct verifs_str) || vstr->len == 0)
+        return -EINVAL;
+    if (vstr->len >= bufsz)
+        return -ENAMETOOLONG;
+    struct iovec local = {.iov_base = buf, .iov_len = vstr->len};
+    struct iovec remote = {.iov_base = vstr->str, .iov_len = vstr->len};
+    ssize_t n = process_vm_readv(fuse_req_ctx(req)->pid, &local, 1,
+                                 &remote, 1, 0);
+    if (n < 0)
+        return -errno;
+    if ((size_t)n != vstr->len)
+        return -EFAULT;
+    buf[n] = '\0';
+    return 0;
+}
+
 static void crmfs_ioctl(fuse_req_t req, fuse_ino_t ino, int cmd, void *arg,
                         struct fuse_file_info *fi, unsigned flags,
                         const void *in_buf, size_t in_bufsz, size_t out_bufsz)
@@ -1002,8 +1201,45 @@ static void crmfs_ioctl(fuse_req_t req, fuse_ino_t ino, int cmd, void *arg,
             ret = restore((uint64_t)arg);
             break;
 
+        case VERIFS_PICKLE:
+        case VERIFS_LOAD: {
+            char path[PATH_MAX];
+            ret = read_caller_str(req, in_buf, in_bufsz, path, sizeof(path));
+            if (ret == 0)
+                ret = (cmd == VERIFS_PICKLE) ? pickle(path) : load(path);
+            break;
+        }
+
+        case VERIFS_POOL_STAT: {
+            struct verifs_pool_stat st;
+            if (out_bufsz < sizeof(st)) {
+                ret = -EINVAL;
+                break;
+            }
+            crmfs_lock(__func__);
+            state_pool_stat(&st);
+            crmfs_unlock(__func__);
+            fuse_reply_ioctl(req, 0, &st, sizeof(st));
+            return;
+        }
+
+        case VERIFS_ABSTRACT_STATE: {
+            struct verifs_absfs absarg;
+            if (in_bufsz < sizeof(absarg) || out_bufsz < sizeof(absarg)) {
+                ret = -EINVAL;
+                break;
+            }
+            memcpy(&absarg, in_buf, sizeof(absarg));
+            ret = abstract_state(&absarg);
+            if (ret == 0) {
+                fuse_reply_ioctl(req, 0, &absarg, sizeof(absarg));
+                return;
+            }
+            break;
+        }
+
         default:
-            ret = ENOTSUP;
+            ret = -ENOTSUP;
             break;
     }
     if (ret == 0) {
@@ -1025,7 +1261,7 @@ struct fuse_lowlevel_ops crmfs_ops = {
     .rmdir = crmfs_rmdir,
     .open = crmfs_open,
     .read = crmfs_read,
-    .write = crmfs_write,
+    .write_buf = crmfs_write_buf,
     .flush = crmfs_flush,
     .readdir = crmfs_read_dir,
     .statfs = crmfs_statfs,
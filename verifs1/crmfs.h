@@ -67,6 +67,18 @@ struct crmfs_dirtable {
 #define CRM_DEFAULT_ICAP      50
 #define CRM_INIT_DIR_CAP      8
 
+/* Pickled state files, see pickle_files() in cr.cpp */
+#define CRM_PICKLE_MAGIC      0x4c4b4349504d5243ULL  /* "CRMPICKL" */
+#define CRM_PICKLE_VERSION    1
+/* Memory budget (in MiB) of the state pool; unset or 0 means unlimited */
+#define CRM_POOL_BUDGET_ENV   "CRMFS_POOL_BUDGET_MB"
+/* Where states over the budget are spilled to */
+#define CRM_SPILL_DIR_ENV     "CRMFS_SPILL_DIR"
+#define CRM_DEFAULT_SPILL_DIR "/tmp"
+/* Hard cap (in MiB) of the memory used by the state pool, over which
+ * checkpoints fail with ENOSPC; unset or 0 means unlimited */
+#define CRM_POOL_MAX_ENV      "CRMFS_POOL_MAX_MB"
+
 struct crmfs_state {
   size_t nfiles;
   struct crmfs_file *files;
@@ -90,6 +102,8 @@ static inline bool IS_ERR(void *ptr)
   return (unsigned long) ptr >= (unsigned long) -MAX_ERRNO;
 }
 
+/* abstract_fs.h has the same helpers */
+#ifndef _ABSTRACT_FS_H
 static inline size_t round_up(size_t n, size_t unit)
 {
   return ((n + unit - 1) / unit) * unit;
@@ -99,6 +113,7 @@ static inline size_t round_down(size_t n, size_t unit)
 {
   return round_up(n, unit) - unit;
 }
+#endif
 
 static inline size_t nblocks(size_t size)
 {
@@ -135,9 +150,20 @@ static inline void _crmfs_debug(const char *fmt, ...)
 extern "C" {
 #endif
 
-int insert_state(uint64_t key, void *ptr);
+void state_pool_init(size_t icap);
+int state_pool_make_room(size_t nbytes);
+int insert_state(uint64_t key, void *ptr, size_t nbytes);
 void *find_state(uint64_t key);
 int remove_state(uint64_t key);
+void state_pool_stat(struct verifs_pool_stat *st);
+
+size_t file_table_bytes(const struct crmfs_file *table, size_t icap);
+void free_file_table(struct crmfs_file *table, size_t icap);
+struct crmfs_file *copy_file_table(const struct crmfs_file *table,
+                                   size_t icap);
+int pickle_files(const char *path, const struct crmfs_file *table,
+                 size_t icap);
+struct crmfs_file *load_files(const char *path, size_t icap);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2020-2024 Yifei Liu
+ * Copyright (c) 2020-2024 Wei Su
+ * Copyright (c) 2020-2024 Erez Zadok
+ * Copyright (c) 2020-2024 Stony Brook University
+ * Copyright (c) 2020-2024 The Research Foundation of SUNY
+ *
+ * You can redistribute it and/or modify it under the terms of the Apache
+ * License, Version 2.0 (http://www.apache.org/licenses/LICENSE-2.0).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include "errnoname.h"
+#include "crmfs.h"
+
+/* The same tool, built with -DCRM_LOAD_TOOL, is the load tool */
+#ifdef CRM_LOAD_TOOL
+#define TOOL_IOCTL VERIFS_LOAD
+#define TOOL_MSG   "Loading file system at %s from %s\n"
+#else
+#define TOOL_IOCTL VERIFS_PICKLE
+#define TOOL_MSG   "Pickling file system at %s to %s\n"
+#endif
+
+int main(int argc, char **argv)
+{
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <mountpoint> <file>\n", argv[0]);
+        exit(1);
+    }
+
+    const char *mp = argv[1];
+    char path[PATH_MAX];
+    /* The daemon does not share our cwd, so hand it an absolute path */
+    if (argv[2][0] == '/') {
+        snprintf(path, sizeof(path), "%s", argv[2]);
+    } else {
+        char cwd[PATH_MAX];
+        if (!getcwd(cwd, sizeof(cwd))) {
+            fprintf(stderr, "Cannot get cwd: %s\n", errnoname(errno));
+            exit(1);
+        }
+        snprintf(path, sizeof(path), "%s/%s", cwd, argv[2]);
+    }
+    printf(TOOL_MSG, mp, path);
+
+    int dirfd = open(mp, O_RDONLY | __O_DIRECTORY);
+    if (dirfd < 0) {
+        fprintf(stderr, "Cannot open %s: %s\n", mp, errnoname(errno));
+        exit(1);
+    }
+
+    struct verifs_str arg = {.len = strlen(path), .str = path};
+    int ret = ioctl(dirfd, TOOL_IOCTL, &arg);
+    if (ret != 0) {
+        printf("Result: ret = %d, errno = %d (%s)\n",
+               ret, errno, errnoname(errno));
+    }
+    return (ret == 0) ? 0 : 1;
+}